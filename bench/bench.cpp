@@ -0,0 +1,317 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include "littlelambda.h"
+
+// Benchmarks, run from the bench directory like lam_test is run from test.
+//
+// Script workloads are .ll files which define a function 'work'. They are driven by a tail
+// recursive loop so that a single lila_eval runs all iterations, once with the tree walking
+// evaluator and once with compiled bytecode. Host workloads drive the public api from C++.
+//
+// Reported per workload and mode:
+// * ns/op
+// * allocs/op, mem_alloc calls plus the allocations the library makes through operator new
+// * peak bytes allocated through mem_alloc over the lifetime of the vm
+// * garbage collector counters
+// * MB/s for the parse workloads
+//
+// Iteration counts are fixed so that runs can be compared. "lam_bench --json" prints the
+// results as JSON instead of a table, e.g. to diff two commits.
+
+static std::atomic<size_t> new_count;  // the library may parse on several threads
+
+void* operator new(size_t size) {
+    new_count += 1;
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+    free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+struct BenchHooks : lila_hooks {
+    // Each block is prefixed with its size to track the number of bytes in use.
+    static constexpr size_t Header = 16;
+
+    size_t nalloc{};
+    size_t bytes{};
+    size_t peak{};
+
+    void* mem_alloc(size_t size) override {
+        nalloc += 1;
+        bytes += size;
+        if (bytes > peak) {
+            peak = bytes;
+        }
+        auto p = static_cast<char*>(malloc(size + Header));
+        memcpy(p, &size, sizeof(size));
+        return p + Header;
+    }
+    void mem_free(void* addr) override {
+        auto p = static_cast<char*>(addr) - Header;
+        size_t size;
+        memcpy(&size, p, sizeof(size));
+        bytes -= size;
+        free(p);
+    }
+    void init() override {}
+    void quit() override {}
+    void output(const char* s, size_t n) override {}
+    lila_result import(lila_vm* vm, const char* modname) override {
+        return lila_result::FileNotFound;
+    }
+};
+
+static bool slurp_file(const char* path, std::string& out) {
+    FILE* fin = fopen(path, "rb");
+    if (fin == nullptr) {
+        return false;
+    }
+    out.clear();
+    char b[4096];
+    while (size_t n = fread(b, 1, sizeof(b), fin)) {
+        out.append(b, n);
+    }
+    fclose(fin);
+    return true;
+}
+
+static lila_result eval_string(lila_vm* vm, const std::string& src) {
+    const char* cur = src.data();
+    const char* end = src.data() + src.size();
+    while (cur < end) {
+        const char* next = nullptr;
+        if (lila_parse(vm, cur, end, &next) != lila_result::Ok) {
+            return lila_result::Ok;  // trailing whitespace
+        }
+        cur = next;
+        if (lila_eval(vm, -1) != lila_result::Ok) {
+            return lila_result::Fail;
+        }
+        lila_pop(vm, 1);
+    }
+    return lila_result::Ok;
+}
+
+static const char driver[] = R"---(
+    ($define (run n) ($if (<= n 0) 0 (begin (work) (run (- n 1)))))
+)---";
+
+// Host workloads. 'src' is the contents of the workload file.
+
+static lila_result parse_all(lila_vm* vm, const std::string& src, int iterations) {
+    for (int i = 0; i < iterations; ++i) {
+        const char* cur = src.data();
+        const char* end = src.data() + src.size();
+        const char* next = nullptr;
+        while (cur < end && lila_parse(vm, cur, end, &next) == lila_result::Ok) {
+            lila_pop(vm, 1);
+            cur = next;
+        }
+    }
+    return lila_result::Ok;
+}
+
+static lila_result import_module(lila_vm* vm, const std::string& src, int iterations) {
+    for (int i = 0; i < iterations; ++i) {
+        std::string name = "mod" + std::to_string(i);  // modules can not be redefined
+        if (lila_vm_import(vm, name.c_str(), src.data(), src.size()) != lila_result::Ok) {
+            return lila_result::Fail;
+        }
+        lila_pop(vm, 1);
+    }
+    return lila_result::Ok;
+}
+
+// The vm does not copy strings from the source, which outlives it.
+static lila_result import_owned(lila_vm* vm, const std::string& src, int iterations) {
+    for (int i = 0; i < iterations; ++i) {
+        std::string name = "mod" + std::to_string(i);
+        if (lila_vm_import_owned(vm, name.c_str(), src.data(), src.size()) != lila_result::Ok) {
+            return lila_result::Fail;
+        }
+        lila_pop(vm, 1);
+    }
+    return lila_result::Ok;
+}
+
+static lila_result import_threads(lila_vm* vm, const std::string& src, int iterations) {
+    lila_vm_set_parse_threads(vm, 0);
+    return import_module(vm, src, iterations);
+}
+
+// The .llc is made once, as a cache keyed by lila_llc_hash would.
+static lila_result import_llc(lila_vm* vm, const std::string& src, int iterations) {
+    std::string llc(lila_vm_save_llc(vm, src.data(), src.size(), nullptr, 0), '\0');
+    lila_vm_save_llc(vm, src.data(), src.size(), llc.data(), llc.size());
+    for (int i = 0; i < iterations; ++i) {
+        std::string name = "mod" + std::to_string(i);
+        if (lila_vm_import_llc(vm, name.c_str(), llc.data(), llc.size()) != lila_result::Ok) {
+            return lila_result::Fail;
+        }
+        lila_pop(vm, 1);
+    }
+    return lila_result::Ok;
+}
+
+struct Workload {
+    const char* name;
+    const char* file;
+    int iterations;
+    lila_result (*host)(lila_vm* vm, const std::string& src, int iterations);  // or a script
+    std::string setup;  // evaluated before the script, or the source if there is no file
+};
+
+struct Result {
+    double ns;         // per iteration
+    double allocs;     // per iteration
+    size_t peak;       // bytes
+    lila_gc_stats gc;  // counters for the whole run
+    bool ok;
+};
+
+static Result run(const Workload& w, const std::string& src, bool compile) {
+    BenchHooks hooks;
+    lila_vm* vm = lila_vm_new(&hooks);
+    lila_vm_set_compile(vm, compile);
+    bool ok = true;
+    if (w.host == nullptr) {
+        ok = eval_string(vm, w.setup) == lila_result::Ok &&
+             eval_string(vm, src) == lila_result::Ok &&
+             eval_string(vm, driver) == lila_result::Ok;
+    }
+    std::string call = "(run " + std::to_string(w.iterations) + ")";
+    size_t nalloc = hooks.nalloc + new_count;
+    auto t0 = std::chrono::steady_clock::now();
+    if (ok) {
+        ok = (w.host ? w.host(vm, src, w.iterations) : eval_string(vm, call)) == lila_result::Ok;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    nalloc = hooks.nalloc + new_count - nalloc;
+    Result r{};
+    lila_vm_gc_stats(vm, &r.gc);
+    lila_vm_delete(vm);
+    r.ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / w.iterations;
+    r.allocs = double(nalloc) / w.iterations;
+    r.peak = hooks.peak;
+    r.ok = ok;
+    return r;
+}
+
+int main(int argc, char** argv) {
+    bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+
+    std::string numbers = "($define numbers (list";
+    for (int i = 0; i < 10000; ++i) {
+        numbers += " " + std::to_string(i % 7);
+    }
+    numbers += "))";
+
+    // A large module with a mix of long comments, strings, words and nesting.
+    std::string large;
+    for (int i = 0; i < 2000; ++i) {
+        std::string n = std::to_string(i);
+        large += ";; Definition number " + n + ", which is commented at some length to see how\n";
+        large += ";; quickly the tokenizer skips over prose which it does not need to look at.\n";
+        large += "($define (function-" + n + " first-argument second-argument)\n";
+        large += "    ($if (<= first-argument " + n + ".5)\n";
+        large += "        (print \"a string literal of moderate length for " + n + "\")\n";
+        large += "        (list.append (list first-argument second-argument) (list 1 2 3))))\n\n";
+    }
+
+    // Deeply nested data, as in a generated tree.
+    std::string nested;
+    for (int i = 0; i < 200; ++i) {
+        for (int depth = 0; depth < 64; ++depth) {
+            nested += "(node " + std::to_string(depth) + " (leaf 1.5) ";
+        }
+        nested += "\"end\"" + std::string(64, ')') + "\n";
+    }
+
+    // A generated module with many independent definitions.
+    std::string defs;
+    for (int i = 0; i < 20000; ++i) {
+        std::string n = std::to_string(i);
+        defs += "($define (f" + n + " x y) ($if (< x y) (list x \"" + n + "\") (f" + n;
+        defs += " y x)))\n";
+    }
+
+    Workload workloads[] = {
+        {"parse", "module.ll", 20000, parse_all},
+        {"parse-large", nullptr, 20, parse_all, large},
+        {"parse-nested", nullptr, 50, parse_all, nested},
+        {"fib", "fib.ll", 200},
+        {"fib-bigint", "fib-bigint.ll", 20},
+        {"fact", "fact.ll", 20000},
+        {"fact-bigint", "fact-bigint.ll", 5000},
+        {"mapreduce", "mapreduce.ll", 20, nullptr, numbers},
+        {"dotted", "dotted.ll", 50000},
+        {"closure", "closure.ll", 50000},
+        {"call", "call.ll", 50000},
+        {"loop", "loop.ll", 20000},
+        {"loop-native", "loop-native.ll", 20000},
+        {"import", "module.ll", 2000, import_module},
+        {"import-llc", "module.ll", 2000, import_llc},
+        {"import-defs", nullptr, 5, import_module, defs},
+        {"import-mt", nullptr, 5, import_threads, defs},
+        {"config", "config.ll", 500, import_module},
+        {"config-owned", "config.ll", 500, import_owned},
+    };
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("%-12s %-8s %12s %12s %12s %8s %12s %13s %8s\n", "workload", "mode", "ns/op",
+               "allocs/op", "peak bytes", "minor gc", "promoted/op", "max pause us", "MB/s");
+    }
+    bool first = true;
+    int failed = 0;
+    for (const Workload& w : workloads) {
+        std::string src = w.setup;
+        if (w.file && !slurp_file(w.file, src)) {
+            fprintf(stderr, "%s: can not read %s\n", w.name, w.file);
+            failed += 1;
+            continue;
+        }
+        for (bool compile : {false, true}) {
+            Result r = run(w, src, compile);
+            const char* mode = compile ? "bytecode" : "eval";
+            double promoted = double(r.gc.promoted) / w.iterations;
+            double mbps = w.host == parse_all ? src.size() / r.ns * 1e3 : 0;
+            if (!r.ok) {
+                fprintf(stderr, "%s (%s): failed\n", w.name, mode);
+                failed += 1;
+            } else if (json) {
+                printf("%s  {\"workload\": \"%s\", \"mode\": \"%s\", \"iterations\": %d, ",
+                       first ? "" : ",\n", w.name, mode, w.iterations);
+                printf("\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"peak_bytes\": %zu, ",
+                       r.ns, r.allocs, r.peak);
+                printf("\"minor_collections\": %llu, \"major_collections\": %llu, ",
+                       r.gc.minor_collections, r.gc.major_collections);
+                printf("\"promoted_per_op\": %.2f, \"max_pause_us\": %llu", promoted,
+                       r.gc.max_pause_us);
+                printf(mbps ? ", \"mb_per_s\": %.1f}" : "}", mbps);
+                first = false;
+            } else {
+                printf("%-12s %-8s %12.0f %12.2f %12zu %8llu %12.2f %13llu %8.1f\n", w.name, mode,
+                       r.ns, r.allocs, r.peak, r.gc.minor_collections, promoted,
+                       r.gc.max_pause_us, mbps);
+            }
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,10 @@
+;; Call overhead of applicatives and operatives with zero to four arguments.
+($define (f0) 0)
+($define (f1 a) a)
+($define (f2 a b) b)
+($define (f3 a b c) c)
+($define (f4 a b c d) d)
+($define ($o0) env 0)
+($define ($o2 a b) env b)
+($define ($o4 a b c d) env d)
+($define (work) (begin (f0) (f1 1) (f2 1 2) (f3 1 2 3) (f4 1 2 3 4) ($o0) ($o2 1 2) ($o4 1 2 3 4)))
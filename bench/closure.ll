@@ -0,0 +1,4 @@
+;; Closure creation and calls through closures.
+($define (twice x) (* 2 x))
+($define repeat ($lambda (f) ($lambda (x) (f (f x)))))
+($define (work) ((repeat (repeat twice)) 10))
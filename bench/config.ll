@@ -0,0 +1,86 @@
+;; Generated style configuration module, mostly string literals, for the import workloads.
+($module hosts
+    ($define host0 "service-000.internal.example.com")
+    ($define host1 "service-001.internal.example.com")
+    ($define host2 "service-002.internal.example.com")
+    ($define host3 "service-003.internal.example.com")
+    ($define host4 "service-004.internal.example.com")
+    ($define host5 "service-005.internal.example.com")
+    ($define host6 "service-006.internal.example.com")
+    ($define host7 "service-007.internal.example.com")
+    ($define host8 "service-008.internal.example.com")
+    ($define host9 "service-009.internal.example.com")
+    ($define host10 "service-010.internal.example.com")
+    ($define host11 "service-011.internal.example.com")
+    ($define host12 "service-012.internal.example.com")
+    ($define host13 "service-013.internal.example.com")
+    ($define host14 "service-014.internal.example.com")
+    ($define host15 "service-015.internal.example.com")
+    ($define host16 "service-016.internal.example.com")
+    ($define host17 "service-017.internal.example.com")
+    ($define host18 "service-018.internal.example.com")
+    ($define host19 "service-019.internal.example.com")
+    ($define host20 "service-020.internal.example.com")
+    ($define host21 "service-021.internal.example.com")
+    ($define host22 "service-022.internal.example.com")
+    ($define host23 "service-023.internal.example.com")
+    ($define host24 "service-024.internal.example.com")
+    ($define host25 "service-025.internal.example.com")
+    ($define host26 "service-026.internal.example.com")
+    ($define host27 "service-027.internal.example.com")
+    ($define host28 "service-028.internal.example.com")
+    ($define host29 "service-029.internal.example.com")
+    ($define host30 "service-030.internal.example.com")
+    ($define host31 "service-031.internal.example.com")
+    ($define host32 "service-032.internal.example.com")
+    ($define host33 "service-033.internal.example.com")
+    ($define host34 "service-034.internal.example.com")
+    ($define host35 "service-035.internal.example.com")
+    ($define host36 "service-036.internal.example.com")
+    ($define host37 "service-037.internal.example.com")
+    ($define host38 "service-038.internal.example.com")
+    ($define host39 "service-039.internal.example.com")
+)
+($module paths
+    ($define path0 "/var/lib/service/shard-000/data/current/snapshot.bin")
+    ($define path1 "/var/lib/service/shard-001/data/current/snapshot.bin")
+    ($define path2 "/var/lib/service/shard-002/data/current/snapshot.bin")
+    ($define path3 "/var/lib/service/shard-003/data/current/snapshot.bin")
+    ($define path4 "/var/lib/service/shard-004/data/current/snapshot.bin")
+    ($define path5 "/var/lib/service/shard-005/data/current/snapshot.bin")
+    ($define path6 "/var/lib/service/shard-006/data/current/snapshot.bin")
+    ($define path7 "/var/lib/service/shard-007/data/current/snapshot.bin")
+    ($define path8 "/var/lib/service/shard-008/data/current/snapshot.bin")
+    ($define path9 "/var/lib/service/shard-009/data/current/snapshot.bin")
+    ($define path10 "/var/lib/service/shard-010/data/current/snapshot.bin")
+    ($define path11 "/var/lib/service/shard-011/data/current/snapshot.bin")
+    ($define path12 "/var/lib/service/shard-012/data/current/snapshot.bin")
+    ($define path13 "/var/lib/service/shard-013/data/current/snapshot.bin")
+    ($define path14 "/var/lib/service/shard-014/data/current/snapshot.bin")
+    ($define path15 "/var/lib/service/shard-015/data/current/snapshot.bin")
+    ($define path16 "/var/lib/service/shard-016/data/current/snapshot.bin")
+    ($define path17 "/var/lib/service/shard-017/data/current/snapshot.bin")
+    ($define path18 "/var/lib/service/shard-018/data/current/snapshot.bin")
+    ($define path19 "/var/lib/service/shard-019/data/current/snapshot.bin")
+    ($define path20 "/var/lib/service/shard-020/data/current/snapshot.bin")
+    ($define path21 "/var/lib/service/shard-021/data/current/snapshot.bin")
+    ($define path22 "/var/lib/service/shard-022/data/current/snapshot.bin")
+    ($define path23 "/var/lib/service/shard-023/data/current/snapshot.bin")
+    ($define path24 "/var/lib/service/shard-024/data/current/snapshot.bin")
+    ($define path25 "/var/lib/service/shard-025/data/current/snapshot.bin")
+    ($define path26 "/var/lib/service/shard-026/data/current/snapshot.bin")
+    ($define path27 "/var/lib/service/shard-027/data/current/snapshot.bin")
+    ($define path28 "/var/lib/service/shard-028/data/current/snapshot.bin")
+    ($define path29 "/var/lib/service/shard-029/data/current/snapshot.bin")
+    ($define path30 "/var/lib/service/shard-030/data/current/snapshot.bin")
+    ($define path31 "/var/lib/service/shard-031/data/current/snapshot.bin")
+    ($define path32 "/var/lib/service/shard-032/data/current/snapshot.bin")
+    ($define path33 "/var/lib/service/shard-033/data/current/snapshot.bin")
+    ($define path34 "/var/lib/service/shard-034/data/current/snapshot.bin")
+    ($define path35 "/var/lib/service/shard-035/data/current/snapshot.bin")
+    ($define path36 "/var/lib/service/shard-036/data/current/snapshot.bin")
+    ($define path37 "/var/lib/service/shard-037/data/current/snapshot.bin")
+    ($define path38 "/var/lib/service/shard-038/data/current/snapshot.bin")
+    ($define path39 "/var/lib/service/shard-039/data/current/snapshot.bin")
+)
+($define banner "configuration\nversion 1")
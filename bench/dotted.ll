@@ -0,0 +1,6 @@
+;; Calls through nested modules.
+($module foo
+    ($define (area x y) (* x y))
+    ($module bar
+        ($define (thrice x) (* 3 x))))
+($define (work) (+ (+ (foo.bar.thrice 1) (foo.bar.thrice 2)) (foo.area 4 5)))
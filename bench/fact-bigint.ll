@@ -0,0 +1,3 @@
+;; Non tail recursive factorial, the result does not fit in a small integer.
+($define (fact n) ($if (<= n 1) 1 (* n (fact (- n 1)))))
+($define (work) (fact (bigint 35)))
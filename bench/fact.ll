@@ -0,0 +1,3 @@
+;; Non tail recursive factorial, small integers.
+($define (fact n) ($if (<= n 1) 1 (* n (fact (- n 1)))))
+($define (work) (fact 12))
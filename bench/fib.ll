@@ -0,0 +1,3 @@
+;; Doubly recursive fibonacci, small integers.
+($define (fib n) ($if (<= n 1) n (+ (fib (- n 1)) (fib (- n 2)))))
+($define (work) (fib 15))
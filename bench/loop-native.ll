@@ -0,0 +1,2 @@
+;; The loop of loop.ll written with $loop, which updates its bindings in place.
+($define (work) ($loop (n 100 acc 0) (<= 1 n) ((- n 1) (+ acc 1)) acc))
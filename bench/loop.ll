@@ -0,0 +1,3 @@
+;; A tail recursive loop, which runs in a single call frame.
+($define (count n acc) ($if (<= n 0) acc (count (- n 1) (+ acc 1))))
+($define (work) (count 100 0))
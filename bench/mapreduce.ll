@@ -0,0 +1,4 @@
+;; Count the zeros in 'numbers', a list of 10000 small integers defined by bench.cpp.
+($define (curry1 fn arg1) ($lambda (x) (fn arg1 x)))
+($define (count item lst) (mapreduce (curry1 equal? item) + lst))
+($define (work) (count 0 numbers))
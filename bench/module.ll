@@ -0,0 +1,11 @@
+;; Module body for the import workload.
+($define pi 3.14159)
+($define (area r) (* pi (* r r)))
+($define (perimeter r) (* 2 (* pi r)))
+($module shapes
+    ($define (square x) (* x x))
+    ($define (rect x y) (* x y))
+    ($module solid
+        ($define (cube x) (* x (* x x)))))
+($define (fact n) ($if (<= n 1) 1 (* n (fact (- n 1)))))
+($define (fib n) ($if (<= n 1) n (+ (fib (- n 1)) (fib (- n 2)))))
@@ -41,4 +41,5 @@ struct lam_hooks {
     virtual void quit() = 0;
     virtual void output(const char* s, size_t n) = 0;
     virtual lam_code import(lam_vm* vm, const char* modname) = 0;
+    virtual void source_free(const void* /*data*/, size_t /*len*/) {}
 };
@@ -0,0 +1,735 @@
+#include "lam_core.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Bytecode for $define/$lambda bodies.
+//
+// Compiling removes the re-walking of the body lists. References to the parameters of an
+// applicative are resolved to slots of its call frame, all other symbols are resolved in the
+// environment at runtime. A few builtin operatives ($if, begin, $quote and $lambda) are expanded
+// inline behind a guard which checks that the head symbol still refers to the builtin. If it does
+// not, the whole form is handed to lam_eval.
+//
+// An inline $lambda makes a flat closure. It copies the values of the parameters (or captured
+// values) of the enclosing frame which its body mentions, and its environment is the one around
+// that frame, e.g. the module, so lookups do not walk the frames of enclosing calls and the
+// closure does not keep them alive. A body which uses eval or getenv may need any binding, so its
+// closure keeps the frame as its environment, though it captures values all the same.
+//
+// Frames are still first class environments: eval, getenv or an operative can $define new names
+// in them. A captured value is only used while the frame of the closure has no such bindings,
+// otherwise the symbol is looked up by name, so shadowing works as under lam_eval. A closure made
+// in a frame which has such bindings keeps the frame. Names defined in a frame after a flat
+// closure was made in it are not seen by the closure.
+//
+// A call from compiled code to a compiled applicative does not recurse on the C stack. The caller
+// is suspended on vm->frames and resumed when the callee returns, so the depth of recursion is
+// only bounded by the heap. Builtins which call back into the evaluator still nest.
+//
+// The frame of such a call is taken from the frame pool and released when the call returns, so
+// calls do not fill the nursery. A frame must not outlive its call, so before the environment is
+// handed to anything which might keep it (the tree walking evaluator, an operative, a closure
+// which keeps its frame or a builtin such as getenv) the frame is moved to the heap. Bodies which
+// do that unconditionally get heap frames from the start.
+//
+// Entering a compiled applicative is a safe point for minor collections. The running activation
+// is suspended on vm->frames too, so the collector can update it, and is then reloaded. Calls out
+// to lam_eval, builtins or operatives may reach safe points as well, so the activation is
+// suspended across them in the same way. The arguments of an operative are copied out of the
+// code into a window of the operand stack first.
+//
+// Symbols which are not lexical are looked up through an inline cache of the instruction. The
+// result depends on the frames of the enclosing applicatives, which are new for each call, and
+// on the environment they lead to, the 'home' of the lookup, e.g. a module. The cache keeps the
+// home and the value found there, and is used while the frames have no dynamic bindings, the
+// home is the same and nothing has been bound since in the environments which the lookup
+// searched, see lam_vm::env_version. Builtins such as + or $if are found in the sealed root
+// environment, so the cache stays valid until a program defines more names. The home of a
+// lookup in an operative is the environment of its call, so those are not cached.
+//
+// An instruction is a 32 bit word with the opcode in the low 8 bits and the operand 'a' in the
+// upper 24 bits. Some instructions are followed by extra words, e.g. the target of a jump.
+
+namespace {
+
+enum class Op : std::uint8_t {
+    Const,        // push consts[a]
+    Lookup,       // [cache] push the value of the symbol consts[a]
+    Arg,          // push slot 'a' of the current frame
+    Capture,      // push captured value 'a' of the current closure, if the frame has no dynamic
+                  // bindings. Otherwise look up its name.
+    Path,         // replace the environment on the top of the stack with the value of the rest
+                  // of the path consts[a] in it
+    Pop,          // drop the top of the stack
+    Jump,         // pc = [target]
+    JumpIfNot,    // pop, if not truthy pc = [target]
+    Guard,        // [builtin][target][cache] if the symbol consts[a] is not consts[builtin],
+                  // pc = target
+    Eval,         // push lam_eval(consts[a], env)
+    TailEval,     // return the tail call (consts[a], env)
+    Closure,      // [body][code][captures][flat] pop the values of the symbols in the list
+                  // consts[captures] (or null), push ($lambda consts[a] consts[body]) compiled
+                  // to consts[code] capturing them. If 'flat', leave out the current frame.
+    Operate,      // [target] the top of the stack is the head of the call consts[a]. If it is an
+                  // operative, replace it with the result of the call and pc = target.
+    TailOperate,  // as Operate, but return the result of the operative
+    Call,         // call stack[-a-1] with the 'a' arguments above it, replace all with the result
+    TailCall,     // as Call, but return the result
+    Return,       // return the top of the stack
+};
+
+constexpr std::uint32_t MaxOperand = 0xffffff;
+
+// The words of an inline cache: the index of two consts which hold the home and the value,
+// the number of frames between the current environment and the home, and the two halves of the
+// env_version at which they were stored (0 if never).
+constexpr size_t CacheWords = 4;
+constexpr std::uint32_t Uncached = 0xffffffff;  // the number of frames if there is no cache
+
+struct Compiler {
+    lam_vm* vm;
+    const lam_scope* scope;
+    std::vector<lam_value> consts;
+    std::vector<std::uint32_t> code;
+    std::vector<size_t> caches;  // code words to patch with the index of their consts
+    size_t depth{0};
+    size_t max_depth{0};
+    bool escapes{false};  // see lam_bytecode::escapes
+
+    std::uint32_t constant(lam_value v) {
+        for (size_t i = 0; i < consts.size(); ++i) {
+            if (consts[i].uval == v.uval) {
+                return std::uint32_t(i);
+            }
+        }
+        assert(consts.size() < MaxOperand);
+        consts.push_back(v);
+        return std::uint32_t(consts.size() - 1);
+    }
+
+    void emit(Op op, std::uint32_t a = 0) {
+        assert(a <= MaxOperand);
+        code.push_back(std::uint32_t(op) | (a << 8));
+    }
+
+    // Emit a placeholder word for a jump target, returns its location for 'patch'
+    size_t emit_target() {
+        code.push_back(0);
+        return code.size() - 1;
+    }
+
+    void patch(size_t at) { code[at] = std::uint32_t(code.size()); }
+
+    // Emit an inline cache. Its consts are added at the end so 'constant' never shares them.
+    // The home is the call frame's parent in an applicative, there is none in an operative.
+    void cache() {
+        if (scope == nullptr) {
+            code.insert(code.end(), {0, Uncached, 0, 0});
+            return;
+        }
+        caches.push_back(code.size());
+        code.insert(code.end(), {0, 1, 0, 0});
+    }
+
+    void finish_caches() {
+        for (size_t at : caches) {
+            assert(consts.size() + 2 <= MaxOperand);
+            code[at] = std::uint32_t(consts.size());
+            consts.push_back(lam_make_null());
+            consts.push_back(lam_make_null());
+        }
+    }
+
+    void push() {
+        depth += 1;
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+
+    void pop(size_t n = 1) {
+        assert(depth >= n);
+        depth -= n;
+    }
+
+    // Leave the value of 'v' on the stack, or if 'tail' return it.
+    void expr(lam_value v, bool tail) {
+        switch (v.type()) {
+            case lam_type::Symbol:
+                symbol(v.as_symbol());
+                push();
+                break;
+            case lam_type::List:
+                if (v.as_list()->len == 0) {
+                    fallback(v, tail);
+                } else {
+                    form(v, tail);
+                }
+                return;  // forms handle 'tail' themselves
+            case lam_type::Null:
+            case lam_type::Double:
+            case lam_type::Int:
+            case lam_type::Opaque:
+            case lam_type::String:
+            case lam_type::Applicative:
+            case lam_type::Operative:
+            case lam_type::Error:
+                emit(Op::Const, constant(v));
+                push();
+                break;
+            default:
+                fallback(v, tail);
+                return;
+        }
+        if (tail) {
+            emit(Op::Return);
+        }
+    }
+
+    // A path which starts with a lexical name leads to a different environment on each call,
+    // so the rest of it is looked up without a cache.
+    void symbol(lam_symbol* sym) {
+        if (sym->nsegs && lexical(sym->segs()[0])) {
+            symbol(sym->segs()[0]);
+            emit(Op::Path, constant(lam_make_value(sym)));
+            return;
+        }
+        if (scope && sym->nsegs == 0) {
+            for (size_t i = 0; i <= scope->count; ++i) {
+                if (sym == (i < scope->count ? scope->names[i] : scope->variadic)) {
+                    emit(Op::Arg, std::uint32_t(i));
+                    return;
+                }
+            }
+            for (size_t i = 0; i < scope->ncaptures; ++i) {
+                if (sym == scope->captures[i]) {
+                    emit(Op::Capture, std::uint32_t(i));
+                    return;
+                }
+            }
+        }
+        emit(Op::Lookup, constant(lam_make_value(sym)));
+        cache();
+    }
+
+    // Whether 'sym' is a parameter or captured value of the frame.
+    bool lexical(lam_symbol* sym) const {
+        if (scope == nullptr) {
+            return false;
+        }
+        lam_symbol* const* captures_end = scope->captures + scope->ncaptures;
+        return std::find(scope->names, scope->names + scope->count, sym) !=
+                   scope->names + scope->count ||
+               sym == scope->variadic ||
+               std::find(scope->captures, captures_end, sym) != captures_end;
+    }
+
+    // Whether a call of 'head' cannot reach a user operative: it is a parameter or a builtin.
+    bool known_head(lam_value head, const lam_scope& params) const {
+        if (head.type() != lam_type::Symbol || head.as_symbol()->nsegs) {
+            return false;
+        }
+        lam_symbol* sym = head.as_symbol();
+        if (lexical(sym) ||
+            std::find(params.names, params.names + params.count, sym) !=
+                params.names + params.count ||
+            sym == params.variadic) {
+            return true;
+        }
+        lam_value v = vm->root->lookup(sym);
+        return v.type() == lam_type::Applicative || v.type() == lam_type::Operative;
+    }
+
+    // Collect the symbols of the frame which 'v' mentions anywhere, even quoted, except those in
+    // 'params'. Set 'dynamic' if it may look up names which it does not mention, e.g. with eval
+    // or a user operative which evaluates in the environment of its caller. Lists in a 'call'
+    // position are calls, those which are quoted or parameters of $lambda or $define are not.
+    void free_symbols(lam_value v,
+                      const lam_scope& params,
+                      std::vector<lam_symbol*>& out,
+                      bool& dynamic,
+                      bool call = true) const {
+        if (v.type() == lam_type::List) {
+            lam_list* list = v.as_list();
+            if (list->len == 0) {
+                return;
+            }
+            lam_value head = list->at(0);
+            const char* name = head.type() == lam_type::Symbol ? head.as_symbol()->val() : "";
+            bool quote = strcmp(name, "$quote") == 0;
+            bool binder = strcmp(name, "$lambda") == 0 || strcmp(name, "$define") == 0;
+            dynamic |= call && !known_head(head, params);
+            for (size_t i = 0; i < list->len; ++i) {
+                bool code = call && !quote && !(binder && i == 1);
+                free_symbols(list->at(i), params, out, dynamic, code);
+            }
+            return;
+        }
+        if (v.type() != lam_type::Symbol) {
+            return;
+        }
+        lam_symbol* sym = v.as_symbol();
+        if (sym->nsegs) {
+            sym = sym->segs()[0];  // a path starts with a lookup of its first segment
+        }
+        const char* name = sym->val();
+        dynamic |= strcmp(name, "eval") == 0 || strcmp(name, "getenv") == 0;
+        if (lexical(sym) && std::find(out.begin(), out.end(), sym) == out.end() &&
+            std::find(params.names, params.names + params.count, sym) ==
+                params.names + params.count &&
+            sym != params.variadic) {
+            out.push_back(sym);
+        }
+    }
+
+    // Hand 'v' to the tree walking evaluator.
+    void fallback(lam_value v, bool tail) {
+        escapes = true;
+        eval(v, tail);
+    }
+
+    // As fallback, on a path which is not expected to be taken.
+    void eval(lam_value v, bool tail) {
+        if (tail) {
+            emit(Op::TailEval, constant(v));
+        } else {
+            emit(Op::Eval, constant(v));
+            push();
+        }
+    }
+
+    void form(lam_value v, bool tail) {
+        lam_list* list = v.as_list();
+        lam_value head = list->at(0);
+        if (head.type() == lam_type::Symbol && !lexical(head.as_symbol())) {
+            const char* name = head.as_symbol()->val();
+            lam_callable* builtin = nullptr;
+            if (strcmp(name, "$if") == 0 && list->len == 4) {
+                builtin = vm->forms.if_;
+            } else if (strcmp(name, "begin") == 0 && list->len >= 2) {
+                builtin = vm->forms.begin;
+            } else if (strcmp(name, "$quote") == 0 && list->len == 2) {
+                builtin = vm->forms.quote;
+            } else if (strcmp(name, "$lambda") == 0 && list->len == 3 &&
+                       lambda_params(list->at(1))) {
+                builtin = vm->forms.lambda;
+            }
+            if (builtin) {
+                inline_form(v, builtin, tail);
+                return;
+            }
+        }
+        call(v, tail);
+    }
+
+    static bool lambda_params(lam_value params) {
+        if (params.type() == lam_type::Symbol) {
+            return true;
+        }
+        if (params.type() != lam_type::List) {
+            return false;
+        }
+        lam_list* list = params.as_list();
+        for (size_t i = 0; i < list->len; ++i) {
+            if (list->at(i).type() != lam_type::Symbol) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void inline_form(lam_value v, lam_callable* builtin, bool tail) {
+        lam_list* list = v.as_list();
+        size_t start = depth;
+        emit(Op::Guard, constant(list->at(0)));
+        code.push_back(constant(lam_make_value(builtin)));
+        size_t guard = emit_target();
+        cache();
+
+        if (builtin == vm->forms.if_) {
+            expr(list->at(1), false);
+            emit(Op::JumpIfNot);
+            size_t otherwise = emit_target();
+            pop();
+            expr(list->at(2), tail);
+            size_t end = 0;
+            if (!tail) {
+                emit(Op::Jump);
+                end = emit_target();
+            }
+            depth = start;
+            patch(otherwise);
+            expr(list->at(3), tail);
+            if (!tail) {
+                patch(end);
+            }
+        } else if (builtin == vm->forms.begin) {
+            for (size_t i = 1; i + 1 < list->len; ++i) {
+                expr(list->at(i), false);
+                emit(Op::Pop);
+                pop();
+            }
+            expr(list->at(list->len - 1), tail);
+        } else if (builtin == vm->forms.quote) {
+            emit(Op::Const, constant(list->at(1)));
+            push();
+            if (tail) {
+                emit(Op::Return);
+            }
+        } else if (builtin == vm->forms.lambda) {
+            lam_value params = list->at(1);
+            std::vector<lam_symbol*> names;
+            lam_symbol* variadic = nullptr;
+            if (params.type() == lam_type::List) {
+                for (size_t i = 0; i < params.as_list()->len; ++i) {
+                    names.push_back(params.as_list()->at(i).as_symbol());
+                }
+            } else {
+                variadic = params.as_symbol();
+            }
+            lam_scope inner{names.data(), names.size(), variadic};
+            std::vector<lam_symbol*> captures;
+            bool dynamic = false;
+            free_symbols(list->at(2), inner, captures, dynamic);
+            lam_value capture_list = lam_make_null();
+            if (!captures.empty()) {
+                std::vector<lam_value> syms;
+                for (lam_symbol* sym : captures) {
+                    symbol(sym);
+                    push();
+                    syms.push_back(lam_make_value(sym));
+                }
+                capture_list = lam_make_list_v(vm, syms.data(), syms.size());
+            }
+            inner.captures = captures.data();
+            inner.ncaptures = captures.size();
+            lam_bytecode* proto = lam_compile(vm, list->at(2), &inner);
+            emit(Op::Closure, constant(list->at(1)));
+            code.push_back(constant(list->at(2)));
+            code.push_back(constant(lam_make_value(proto)));
+            code.push_back(constant(capture_list));
+            code.push_back(dynamic ? 0 : 1);
+            escapes |= dynamic;
+            pop(captures.size());
+            push();
+            if (tail) {
+                emit(Op::Return);
+            }
+        }
+
+        // Not the builtin: evaluate the whole form the slow way.
+        size_t end = 0;
+        if (!tail) {
+            emit(Op::Jump);
+            end = emit_target();
+        }
+        depth = start;
+        patch(guard);
+        eval(v, tail);
+        if (!tail) {
+            patch(end);
+        }
+    }
+
+    // Whether the arguments are evaluated is only known once the head has been evaluated,
+    // so the argument code is preceded by an Operate which skips it for operatives.
+    void call(lam_value v, bool tail) {
+        lam_list* list = v.as_list();
+        size_t start = depth;
+        expr(list->at(0), false);
+        size_t skip = 0;
+        if (tail) {
+            emit(Op::TailOperate, constant(v));
+        } else {
+            emit(Op::Operate, constant(v));
+            skip = emit_target();
+        }
+        for (size_t i = 1; i < list->len; ++i) {
+            expr(list->at(i), false);
+        }
+        emit(tail ? Op::TailCall : Op::Call, std::uint32_t(list->len - 1));
+        depth = start + 1;
+        if (!tail) {
+            patch(skip);
+        }
+    }
+};
+
+}  // namespace
+
+lam_bytecode* lam_compile(lam_vm* vm, lam_value body, const lam_scope* scope) {
+    Compiler c{vm, scope};
+    c.expr(body, true);
+    c.finish_caches();
+    lam_bytecode* code = lam_new_bytecode(vm, c.consts.data(), c.consts.size(), c.code.data(),
+                                          c.code.size(), c.max_depth);
+    code->escapes = c.escapes;
+    return code;
+}
+
+lam_value_or_tail_call lam_execute(lam_bytecode* code, lam_env* env) {
+    lam_vm* vm = env->vm;
+    const size_t floor = vm->frames.size();  // frames below belong to enclosing calls
+    lam_value* base;
+    lam_value* sp;
+    const lam_value* k;
+    const std::uint32_t* start;
+    const std::uint32_t* pc;
+    auto activate = [&](lam_bytecode* c, lam_env* e) {
+        code = c;
+        env = e;
+        base = sp = vm->operands.enter(code->max_stack);
+        k = code->consts();
+        start = pc = code->code();
+    };
+    auto suspend = [&]() {
+        vm->frames.push_back({code, std::uint32_t(pc - start), env, base, sp});
+    };
+    auto resume = [&]() {
+        lam_frame& f = vm->frames.back();
+        code = f.code;
+        env = f.env;
+        base = f.base;
+        sp = f.sp;
+        k = code->consts();
+        start = code->code();
+        pc = start + f.pc;
+        vm->frames.pop_back();
+        if (vm->frames_clean > vm->frames.size()) {
+            vm->frames_clean = vm->frames.size();
+        }
+    };
+    // Before the environment is handed to code which might keep it.
+    auto escape = [&]() { env = lam_escape_call_env(env); };
+    auto safe_point = [&]() {
+        if (lam_at_safe_point(vm)) {
+            suspend();
+            lam_gc_safe_point(vm);
+            resume();
+        }
+    };
+    // Apply the operative 'head' to the unevaluated arguments of the call consts[a]. Unless
+    // 'tail', a tail call which it returns is evaluated.
+    auto operate = [&](lam_callable* head, std::uint32_t a, bool tail) {
+        lam_list* list = k[a].as_list();
+        size_t narg = list->len - 1;
+        lam_value* args = vm->operands.enter(narg);
+        memcpy(args, list->first() + 1, narg * sizeof(lam_value));
+        suspend();
+        lam_value_or_tail_call r = tail ? lam_apply(head, env, args, narg)
+                                        : lam_eval_call(head, env, args, narg);
+        resume();
+        vm->operands.leave(args);
+        return r;
+    };
+    // Look up 'sym' through the inline cache at 'words', see Compiler::cache.
+    auto lookup = [&](lam_symbol* sym, const std::uint32_t* words) {
+        if (words[1] == Uncached) {
+            return env->lookup(sym);
+        }
+        lam_value* slot = code->consts() + words[0];
+        auto home = static_cast<lam_env_impl*>(env);
+        bool shadowed = false;
+        for (std::uint32_t level = words[1]; level; --level) {
+            shadowed |= !home->_map.empty();
+            home = static_cast<lam_env_impl*>(home->_parent);
+        }
+        if (shadowed) {
+            return env->lookup(sym);
+        }
+        lam_value home_val = lam_make_value(home);
+        lam_u64 version = words[2] | lam_u64(words[3]) << 32;
+        if (version == vm->env_version && slot[0].uval == home_val.uval) {
+            return slot[1];
+        }
+        lam_value v = lam_env_impl::_lookup(sym, env, 0, true);
+        if (v.type() != lam_type::Error) {
+            slot[0] = home_val;
+            slot[1] = v;
+            lam_write_barrier(vm, code, home_val);
+            lam_write_barrier(vm, code, v);
+            auto w = const_cast<std::uint32_t*>(words);
+            w[2] = std::uint32_t(vm->env_version);
+            w[3] = std::uint32_t(vm->env_version >> 32);
+        }
+        return v;
+    };
+    activate(code, env);
+    safe_point();
+    while (true) {
+        lam_value_or_tail_call res = lam_make_null();
+        std::uint32_t insn = *pc++;
+        std::uint32_t a = insn >> 8;
+        switch (Op(insn & 0xff)) {
+            case Op::Const:
+                *sp++ = k[a];
+                continue;
+            case Op::Lookup:
+                *sp++ = lookup(k[a].as_symbol(), pc);
+                pc += CacheWords;
+                continue;
+            case Op::Arg:
+                *sp++ = static_cast<lam_env_impl*>(env)->slots()[a];
+                continue;
+            case Op::Capture: {
+                auto frame = static_cast<lam_env_impl*>(env);
+                lam_callable* closure = frame->_frame;
+                if (frame->_map.empty()) {
+                    *sp++ = closure->captured()[a];
+                } else {
+                    *sp++ = env->lookup(closure->captures->at(a).as_symbol());
+                }
+                continue;
+            }
+            case Op::Path:
+                sp[-1] = lam_env_impl::_lookup(k[a].as_symbol(), sp[-1].as_env(), 1);
+                continue;
+            case Op::Pop:
+                --sp;
+                continue;
+            case Op::Jump:
+                pc = start + *pc;
+                continue;
+            case Op::JumpIfNot:
+                if (lam_truthy(*--sp)) {
+                    pc += 1;
+                } else {
+                    pc = start + *pc;
+                }
+                continue;
+            case Op::Guard:
+                if (lookup(k[a].as_symbol(), pc + 2).uval == k[pc[0]].uval) {
+                    pc += 2 + CacheWords;
+                } else {
+                    pc = start + pc[1];
+                }
+                continue;
+            case Op::Eval: {
+                escape();
+                suspend();
+                lam_value v = lam_eval(k[a], env);
+                resume();
+                *sp++ = v;
+                continue;
+            }
+            case Op::TailEval:
+                escape();
+                res = {k[a], env};
+                break;
+            case Op::Closure: {
+                lam_list* captures = nullptr;
+                if (k[pc[2]].type() == lam_type::List) {
+                    captures = k[pc[2]].as_list();
+                    sp -= captures->len;
+                }
+                auto frame = static_cast<lam_env_impl*>(env);
+                lam_env* parent;
+                if (pc[3] && frame->_frame && frame->_map.empty()) {
+                    parent = frame->_parent;  // all the body needs from the frame is captured
+                } else {
+                    escape();
+                    parent = env;
+                }
+                lam_value closure =
+                    lam_make_lambda(parent, k[a], k[pc[0]], k[pc[1]].as_bytecode(), captures, sp);
+                *sp++ = closure;
+                pc += 4;
+                continue;
+            }
+            case Op::Operate: {
+                lam_callable* head = sp[-1].as_callable();
+                if (head->type == lam_type::Operative) {
+                    escape();
+                    lam_value v = operate(head, a, false).value;
+                    sp[-1] = v;
+                    pc = start + *pc;
+                } else {
+                    pc += 1;
+                }
+                continue;
+            }
+            case Op::TailOperate: {
+                lam_callable* head = sp[-1].as_callable();
+                if (head->type != lam_type::Operative) {
+                    continue;
+                }
+                escape();
+                res = operate(head, a, true);
+                break;
+            }
+            case Op::Call: {
+                sp -= a;
+                lam_callable* callee = sp[-1].as_callable();
+                if (a == 2 && lam_arith_inline(callee->arith, sp[0], sp[1], sp[-1])) {
+                    continue;
+                }
+                if (callee->code && callee->type == lam_type::Applicative) {
+                    // Suspend this activation on the frame stack instead of recursing.
+                    lam_env* inner = lam_new_pooled_call_env(callee, sp, a);
+                    suspend();
+                    activate(callee->code, inner);
+                    safe_point();
+                    continue;
+                }
+                if (callee->keeps_env) {
+                    escape();
+                }
+                suspend();
+                lam_value v = lam_eval_call(callee, env, sp, a);
+                resume();
+                sp[-1] = v;
+                continue;
+            }
+            case Op::TailCall: {
+                sp -= a;
+                lam_callable* callee = sp[-1].as_callable();
+                if (a == 2 && lam_arith_inline(callee->arith, sp[0], sp[1], sp[-1])) {
+                    res = sp[-1];
+                    break;
+                }
+                if (callee->code && callee->type == lam_type::Applicative) {
+                    // Replace this activation rather than nesting another. The arguments are on
+                    // the operand stack, so the frame can make way for the callee's first. A call
+                    // to itself reuses the frame if nothing else can see it.
+                    lam_env* inner = env;
+                    if (callee == static_cast<lam_env_impl*>(env)->_frame && lam_can_rebind(env)) {
+                        lam_rebind_call_env(env, sp, a);
+                    } else {
+                        lam_release_call_env(env);
+                        inner = lam_new_pooled_call_env(callee, sp, a);
+                    }
+                    vm->operands.leave(base);
+                    activate(callee->code, inner);
+                    safe_point();
+                    continue;
+                }
+                if (callee->keeps_env) {
+                    escape();
+                }
+                suspend();
+                res = lam_apply(callee, env, sp, a);
+                resume();
+                break;
+            }
+            case Op::Return:
+                res = sp[-1];
+                break;
+            default:
+                assert(false);
+                return lam_value{};
+        }
+
+        // The activation is finished with 'res'.
+        vm->operands.leave(base);
+        assert(res.env == nullptr || !vm->frame_pool.contains(res.env));
+        lam_release_call_env(env);
+        if (vm->frames.size() == floor) {
+            return res;
+        }
+        lam_value v = res.env ? lam_eval(res.value, res.env) : res.value;
+        resume();
+        sp[-1] = v;
+    }
+}
@@ -1,36 +1,27 @@
 #include "lam_core.h"
 
 #include <inttypes.h>
+#include <algorithm>
+#include <bit>
 #include <charconv>
 #include <cstring>
 #include <format>
 #include <optional>
 #include <span>
 
-#pragma warning(disable : 6011)  // Dereferencing NULL pointer 'pointer-name'.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LAM_SCAN_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LAM_SCAN_NEON 1
+#endif
 
-enum ErrorCode {
-    OK = 0,
-    GenericFailure,
-    ParseEndOfInput,
-    ParseUnexpectedNull,
-    ParseUnexpectedSemiColon,
-    ParseUnexpectedEscape,
-    ParseUnexpectedEndOfFile,
-    ParseUnexpectedEndList,
-    ParseMissingSymbolName,
-    ImportNotFound,
-    SymbolNotFound,
-    WrongNumberOfArguments,
-    NonNumericArguments,
-};
+#pragma warning(disable : 6011)  // Dereferencing NULL pointer 'pointer-name'.
 
 static bool is_white(char c) {
     return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f';
 }
-static bool is_word_boundary(char c) {
-    return is_white(c) || c == '(' || c == ')' || c == '\0';
-}
 static bool is_newline(char c) {
     return c == '\r' || c == '\n';
 }
@@ -38,6 +29,67 @@ static bool is_alpha(char c) {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
+// Find the first byte in [cur, end) which is one of 'Chars', or if 'Not', is none of them.
+// Looks at 16 bytes at a time where SSE2 or NEON is available, which is always the case on
+// x86-64 and AArch64, so there is nothing to detect at runtime.
+template <bool Not, char... Chars>
+static const char* scan(const char* cur, const char* end) {
+#if LAM_SCAN_SSE2
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur));
+        __m128i m = _mm_setzero_si128();
+        ((m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(Chars)))), ...);
+        unsigned bits = unsigned(_mm_movemask_epi8(m));
+        if (Not) {
+            bits ^= 0xffff;
+        }
+        if (bits) {
+            return cur + std::countr_zero(bits);
+        }
+        cur += 16;
+    }
+#elif LAM_SCAN_NEON
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(cur));
+        uint8x16_t m = vdupq_n_u8(0);
+        ((m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(uint8_t(Chars))))), ...);
+        if (Not) {
+            m = vmvnq_u8(m);
+        }
+        // Narrow to 4 bits per byte.
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (bits) {
+            return cur + std::countr_zero(bits) / 4;
+        }
+        cur += 16;
+    }
+#endif
+    for (; cur < end; ++cur) {
+        if (((*cur == Chars) || ...) != Not) {
+            return cur;
+        }
+    }
+    return end;
+}
+
+// The first byte which is not is_white.
+static const char* skip_white(const char* cur, const char* end) {
+    return scan<true, ' ', '\t', '\r', '\n', '\f'>(cur, end);
+}
+// The first byte which is whitespace, a parenthesis or null.
+static const char* find_word_end(const char* cur, const char* end) {
+    return scan<false, ' ', '\t', '\r', '\n', '\f', '(', ')', '\0'>(cur, end);
+}
+// The first is_newline.
+static const char* find_newline(const char* cur, const char* end) {
+    return scan<false, '\r', '\n'>(cur, end);
+}
+// The first byte which ends a run of plain characters in a string literal.
+static const char* find_string_special(const char* cur, const char* end) {
+    return scan<false, '"', '\\', '\0'>(cur, end);
+}
+
 template <typename T, typename... V>
 static bool _try_parse_as(const char* start, const char* end, T& out, V... v) {
     auto [ptr, rc] = std::from_chars(start, end, out, v...);
@@ -51,23 +103,40 @@ static bool _try_parse_as(const char* start, const char* end, T& out, V... v) {
 
 
 // Allocate and zero "sizeof(T) + extra" bytes
-// Register T with the garbage collector
+// T goes in the nursery if it fits, otherwise it is registered with the garbage collector.
+// Symbols and strings always go to old space: they are never moved, so symbol addresses stay
+// stable for the intern table and the host may hold on to string data.
 template <typename T>
 static T* callocPlus(lam_vm* vm, size_t extra) {
-    void* p = vm->hooks->mem_alloc(sizeof(T) + extra);
-    memset(p, 0, sizeof(T) + extra);
-    auto o = reinterpret_cast<T*>(p);
-    ugc_register(&vm->gc, &o->header);
+    constexpr bool old = std::is_same_v<T, lam_symbol> || std::is_same_v<T, lam_string>;
+    void* p = old ? nullptr : vm->nursery.alloc(sizeof(T) + extra);
+    if (p == nullptr) {
+        p = lam_alloc_old(vm, sizeof(T) + extra, !old);
+    }
     vm->gc_stats.alloc_count += 1;
-    return o;
+    return reinterpret_cast<T*>(p);
 }
 
 // Parse null terminated 'input'
-// Set 'restart' to the end of parsing.
-lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const char** restart) {
+// Set 'restart' to the end of parsing. Strings refer to 'input' in place if it is 'owned'.
+static lam_result parse(lam_vm* vm,
+                        const char* input,
+                        const char* endInput,
+                        const char** restart,
+                        bool owned) {
     *restart = input;
-    // No recursion - explicit stack for lists.
-    std::vector<std::vector<lam_value>> stack;
+    // No recursion - explicit stack for lists, on top of the ones of any outer lam_parse.
+    struct Scratch {
+        std::vector<lam_value>& items;
+        std::vector<lam_parse_list>& lists;
+        size_t base_items = items.size();
+        size_t base_lists = lists.size();
+        ~Scratch() {
+            items.resize(base_items);
+            lists.resize(base_lists);
+        }
+        size_t depth() const { return lists.size() - base_lists; }
+    } stack{vm->parse_items, vm->parse_lists};
     for (const char* cur = input; cur < endInput;) {
         std::optional<lam_value> parsed{};
         const char* startCur = cur;
@@ -79,7 +148,7 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
             // parse_end
             case '\0': {
                 *restart = cur - 1;
-                if (!stack.empty()) {
+                if (stack.depth()) {
                     return lam_result::fail(ParseUnexpectedEndOfFile,
                                             "End of file in compound expression");
                 }
@@ -98,9 +167,7 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
                     return lam_result::fail(ParseUnexpectedSemiColon, "Unexpected single ';'");
                 }
                 // Look for the start of any newline sequence \r, \n, \r\n
-                while (cur < endInput && !is_newline(*cur)) {
-                    ++cur;
-                }
+                cur = find_newline(cur, endInput);
                 // Consume any sequence of \r,\n
                 while (cur < endInput && is_newline(*cur)) {
                     ++cur;
@@ -109,30 +176,31 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
             }
             // parse_list
             case '(': {
-                stack.emplace_back();
+                stack.lists.push_back({stack.items.size(), lam_location_line(vm, startCur)});
                 break;
             }
             case ')': {
-                if (stack.empty()) {
+                if (stack.depth() == 0) {
                     return lam_result::fail(ParseUnexpectedEndList,
                                             "End of list without beginning");
                 }
-                std::vector<lam_value> curList = std::move(stack.back());
-                stack.pop_back();
+                lam_parse_list open = stack.lists.back();
+                size_t first = open.first;
+                stack.lists.pop_back();
                 // A literal '.' at the end of a list is a shorthand for appending all
                 // statements until the end of the scope.
                 // e.g. "(foo x .) (a b c) (d e)" is equivalent to "(foo x (a b c) (d e))"
-                if (!curList.empty()) {
-                    lam_value v = curList.back();
+                if (stack.items.size() > first) {
+                    lam_value v = stack.items.back();
                     if (v.type() == lam_type::Symbol && strcmp(v.as_symbol()->val(), ".") == 0) {
-                        std::vector<lam_value> tail;
+                        stack.items.pop_back();
                         for (bool slurp = true; slurp && cur < endInput;) {
                             const char* next = nullptr;
-                            lam_result res = lam_parse(vm, cur, endInput, &next);
+                            lam_result res = parse(vm, cur, endInput, &next, owned);
                             cur = next;
                             switch (res.code) {
                                 case 0:
-                                    tail.push_back(res.value);
+                                    stack.items.push_back(res.value);
                                     break;
                                 case ParseEndOfInput:
                                 case ParseUnexpectedEndList:
@@ -142,19 +210,27 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
                                     return res;
                             }
                         }
-                        curList.pop_back();
-                        curList.insert(curList.end(), tail.begin(), tail.end());
                     }
                 }
-                auto l = lam_make_list_v(vm, curList.data(), curList.size());
+                auto l = lam_make_list_v(vm, stack.items.data() + first,
+                                         stack.items.size() - first);
+                stack.items.resize(first);
+                if (open.line) {
+                    lam_set_location(vm, l.as_list(), open.line);
+                }
                 parsed.emplace(l);
                 break;
             }
             // parse_string
             case '"': {
                 const char* start = cur;  // start of the current run
-                std::string acc;          // accumulator for current string
+                std::string acc;          // accumulator for current string, if it has escapes
+                bool escaped = false;
                 while (!parsed.has_value() && cur < endInput) {
+                    cur = find_string_special(cur, endInput);
+                    if (cur == endInput) {
+                        break;
+                    }
                     switch (char c = *cur++) {
                         case 0: {
                             return lam_result::fail(ParseUnexpectedNull,
@@ -166,6 +242,7 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
                                 acc.push_back('\n');
                                 cur += 1;
                                 start = cur;
+                                escaped = true;
                             } else {
                                 return lam_result::fail(ParseUnexpectedEscape,
                                                         "Unexpected escape sequence");
@@ -173,9 +250,14 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
                             break;
                         }
                         case '"': {
-                            acc.append(start, cur - 1);
-                            auto s = lam_make_string(vm, acc.data(), acc.size());
-                            parsed.emplace(s);
+                            if (escaped) {
+                                acc.append(start, cur - 1);
+                                parsed.emplace(lam_make_string(vm, acc.data(), acc.size()));
+                            } else if (owned) {
+                                parsed.emplace(lam_make_string_view(vm, start, cur - 1 - start));
+                            } else {
+                                parsed.emplace(lam_make_string(vm, start, cur - 1 - start));
+                            }
                             break;
                         }
                         default:
@@ -187,7 +269,7 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
             // parse_quote
             case '\'': {
                 const char* after = nullptr;
-                lam_result quoted = lam_parse(vm, cur, endInput, &after);
+                lam_result quoted = parse(vm, cur, endInput, &after, owned);
                 if (quoted.code != 0) {
                     return quoted;
                 }
@@ -197,29 +279,9 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
                 break;
             }
 
-                //    // keyword
-                // case ':': {
-                //    while (!is_word_boundary(*cur)) {
-                //        ++cur;
-                //    }
-                //    lam_value val = (cur - start > 1) ? lam_make_symbol(start + 1, cur - start -
-                //    1)
-                //                                      : lam_make_error(ParseMissingSymbolName,
-                //                                                       "Missing symbol name after
-                //                                                       ':'");
-                //    if (curList) {
-                //        curList->push_back(val);
-                //    } else {
-                //        *restart = cur;
-                //        return val;
-                //    }
-                //    break;
-                //}
             // parse_number parse_symbol
             default: {
-                while (cur < endInput && !is_word_boundary(*cur)) {
-                    ++cur;
-                }
+                cur = find_word_end(cur, endInput);
 
                 // Todo: tighten these checks. Numbers must begin with - or . or digit?
                 if (cur > startCur && is_alpha(startCur[0])) {
@@ -237,35 +299,335 @@ lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const
         }
 
         // Consume any whitespace & advance restart point
-        while (cur < endInput && is_white(*cur)) {
-            ++cur;
-        }
+        cur = skip_white(cur, endInput);
         *restart = cur;
 
         // Check for explicit recursion end
         if (parsed.has_value()) {
             auto v = parsed.value();
-            if (auto s = stack.size()) {
-                stack[s - 1].push_back(v);
+            if (stack.depth()) {
+                stack.items.push_back(v);
             } else {
                 *restart = cur;
                 return lam_result::ok(v);
             }
         }
     }
-    if (stack.size()) {
+    if (stack.depth()) {
         return lam_result::fail(ParseEndOfInput, "Unexpected Eof");
     }
     return lam_result::ok(lam_make_int(0));
 }
 
+lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const char** restart) {
+    return parse(vm, input, endInput, restart, lam_owns_source(vm, input, endInput));
+}
+
+std::uint32_t lam_location_line(lam_vm* vm, const char* pos) {
+    lam_parse_cursor& c = vm->locations.cursor;
+    if (pos < c.pos || pos >= c.end) {  // not recording, or not parsing the module
+        return 0;
+    }
+    // Lists start in order, so each newline is counted once.
+    c.line += std::uint32_t(std::count(c.pos, pos, '\n'));
+    c.pos = pos;
+    return c.line;
+}
+
+void lam_set_location(lam_vm* vm, lam_obj* obj, std::uint32_t line) {
+    lam_locations& locs = vm->locations;
+    lam_location loc{locs.cursor.file, line};
+    obj->located = true;
+    if (vm->nursery.contains(obj)) {
+        locs.young.emplace_back(obj, loc);
+    } else {
+        locs.old[obj] = loc;
+    }
+}
+
+bool lam_find_location(lam_vm* vm, const lam_obj* obj, const char** file, unsigned* line) {
+    if (!obj->located) {
+        return false;
+    }
+    const lam_locations& locs = vm->locations;
+    lam_location loc;
+    if (auto it = locs.old.find(obj); it != locs.old.end()) {
+        loc = it->second;
+    } else {
+        auto it2 = std::find_if(locs.young.begin(), locs.young.end(),
+                                [obj](const auto& e) { return e.first == obj; });
+        assert(it2 != locs.young.end());
+        loc = it2->second;
+    }
+    *file = locs.files[loc.file].c_str();
+    *line = loc.line;
+    return true;
+}
+
+// The parser only follows enough of the syntax to find where a statement ends, then hands the
+// whole statement to lam_parse. This keeps lam_parse the only place which builds values, and as
+// nothing but text is kept between chunks, objects may move between calls.
+lam_result lam_parser_scan(lam_parser* p,
+                           const char* input,
+                           const char* end,
+                           const char** start,
+                           const char** stop) {
+    auto fail = [&](const char* at, unsigned code, const char* msg) {
+        *stop = at;
+        return lam_result::fail(code, msg);
+    };
+    const char* from = input;  // start of the statement in this chunk
+    for (const char* cur = input; cur < end;) {
+        const char* value_end = nullptr;  // set when a value has just been read
+        switch (p->state) {
+            case lam_parser::Between: {
+                if (is_white(*cur)) {
+                    ++cur;
+                    break;
+                }
+                if (*cur == ';') {
+                    p->state = lam_parser::Semi;
+                    ++cur;
+                    break;
+                }
+                p->started = true;
+                switch (*cur) {
+                    case '(':
+                        p->depth += 1;
+                        break;
+                    case ')':
+                        if (p->depth == 0) {
+                            return fail(cur, ParseUnexpectedEndList,
+                                        "End of list without beginning");
+                        }
+                        p->depth -= 1;
+                        p->dotted |= p->depth == 0 && p->dot;
+                        value_end = cur + 1;
+                        break;
+                    case '"':
+                        p->state = lam_parser::String;
+                        break;
+                    case '\0':
+                        return fail(cur, ParseUnexpectedNull, "Unexpected null");
+                    case '\'':
+                        break;
+                    default:
+                        p->state = lam_parser::Word;
+                        p->dot = *cur == '.';
+                        p->word_len = 0;
+                        continue;  // read the word in its own state
+                }
+                p->dot = false;
+                ++cur;
+                break;
+            }
+            case lam_parser::Word: {
+                const char* word_end = find_word_end(cur, end);
+                p->word_len += word_end - cur;
+                cur = word_end;
+                if (cur < end) {
+                    p->state = lam_parser::Between;
+                    p->dot = p->dot && p->word_len == 1;
+                    value_end = cur;
+                }
+                break;
+            }
+            case lam_parser::String: {
+                cur = find_string_special(cur, end);
+                if (cur == end) {
+                    break;
+                }
+                switch (*cur++) {
+                    case '"':
+                        p->state = lam_parser::Between;
+                        value_end = cur;
+                        break;
+                    case '\\':
+                        p->state = lam_parser::Escape;  // lam_parse checks the escape
+                        break;
+                    default:
+                        return fail(cur - 1, ParseUnexpectedNull,
+                                    "Unexpected null when parsing string");
+                }
+                break;
+            }
+            case lam_parser::Escape: {
+                p->state = lam_parser::String;
+                ++cur;
+                break;
+            }
+            case lam_parser::Semi: {
+                if (*cur != ';') {
+                    return fail(cur, ParseUnexpectedSemiColon, "Unexpected single ';'");
+                }
+                p->state = lam_parser::Comment;
+                ++cur;
+                break;
+            }
+            case lam_parser::Comment: {
+                cur = find_newline(cur, end);
+                if (cur < end) {
+                    p->state = lam_parser::Between;
+                }
+                break;
+            }
+        }
+        if (!p->started) {
+            from = cur;  // skip whitespace and comments between statements
+        } else if (value_end && p->depth == 0 && !p->dotted) {
+            *start = from;
+            *stop = value_end;
+            return lam_result::ok(lam_make_null());
+        }
+    }
+    *start = from;
+    *stop = end;
+    return lam_result::fail(ParseEndOfInput, nullptr);
+}
+
+lam_result lam_parser_feed(lam_vm* vm,
+                           lam_parser* p,
+                           const char* input,
+                           const char* end,
+                           const char** restart) {
+    const char* from = nullptr;
+    lam_result res = lam_parser_scan(p, input, end, &from, restart);
+    if (res.code == ParseEndOfInput) {
+        if (p->started) {
+            p->text.append(from, end);
+        }
+        return res;
+    }
+    if (res.code == 0) {
+        const char* next = nullptr;
+        if (p->text.empty()) {
+            res = lam_parse(vm, from, *restart, &next);
+        } else {
+            p->text.append(from, *restart);
+            res = lam_parse(vm, p->text.data(), p->text.data() + p->text.size(), &next);
+        }
+    }
+    *p = {};
+    return res;
+}
+
+lam_result lam_parser_finish(lam_vm* vm, lam_parser* p) {
+    lam_parser done = std::move(*p);
+    *p = {};
+    if (done.state == lam_parser::Semi) {
+        return lam_result::fail(ParseUnexpectedSemiColon, "Unexpected single ';'");
+    }
+    if (!done.started) {
+        return lam_result::fail(ParseEndOfInput, nullptr);
+    }
+    if (done.state == lam_parser::String || done.state == lam_parser::Escape ||
+        (done.depth != 0 && !done.dotted)) {
+        return lam_result::fail(ParseUnexpectedEndOfFile, "End of file in compound expression");
+    }
+    const char* next = nullptr;
+    return lam_parse(vm, done.text.data(), done.text.data() + done.text.size(), &next);
+}
+
+static lam_u64 hash_name(const char* s, size_t len) {
+    return std::hash<std::string_view>{}({s, len});
+}
+
+lam_symbol* lam_symbol_table::find(const char* s, size_t len, lam_u64 hash) const {
+    if (_slots.empty()) {
+        return nullptr;
+    }
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        lam_symbol* sym = _slots[i];
+        if (sym == nullptr) {
+            return nullptr;
+        }
+        if (sym->hash == hash && sym->len == len && memcmp(sym->val(), s, len) == 0) {
+            return sym;
+        }
+    }
+}
+
+void lam_symbol_table::insert(lam_symbol* sym) {
+    if (2 * (_count + 1) > _slots.size()) {
+        _grow();
+    }
+    size_t mask = _slots.size() - 1;
+    size_t i = sym->hash & mask;
+    while (_slots[i]) {
+        i = (i + 1) & mask;
+    }
+    _slots[i] = sym;
+    _count += 1;
+}
+
+void lam_symbol_table::erase(lam_symbol* sym) {
+    size_t mask = _slots.size() - 1;
+    size_t i = sym->hash & mask;
+    while (_slots[i] != sym) {
+        assert(_slots[i]);
+        i = (i + 1) & mask;
+    }
+    // Backward shift deletion: move later members of the probe sequence into the hole.
+    for (size_t j = (i + 1) & mask; _slots[j]; j = (j + 1) & mask) {
+        size_t home = _slots[j]->hash & mask;
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            _slots[i] = _slots[j];
+            i = j;
+        }
+    }
+    _slots[i] = nullptr;
+    _count -= 1;
+}
+
+void lam_symbol_table::_grow() {
+    std::vector<lam_symbol*> old;
+    old.swap(_slots);
+    _slots.resize(old.empty() ? 256 : 2 * old.size());
+    _count = 0;
+    for (lam_symbol* sym : old) {
+        if (sym) {
+            insert(sym);
+        }
+    }
+}
+
+lam_symbol* lam_find_symbol(lam_vm* vm, const char* s, size_t n) {
+    size_t len = n == size_t(-1) ? strlen(s) : n;
+    return vm->symbols.find(s, len, hash_name(s, len));
+}
+
 lam_value lam_make_symbol(lam_vm* vm, const char* s, size_t n) {
     size_t len = n == size_t(-1) ? strlen(s) : n;
-    auto* d = callocPlus<lam_symbol>(vm, len + 1);
+    lam_u64 hash = hash_name(s, len);
+    if (lam_symbol* sym = vm->symbols.find(s, len, hash)) {
+        if (vm->gc_pace.cycle) {  // may be unreachable and about to be swept, see lam_gc.cpp
+            ugc_visit(&vm->gc, &sym->header);
+        }
+        return lam_make_value(sym);
+    }
+    // Split a path into its segments, unless one of them would be empty.
+    std::vector<lam_symbol*> segs;
+    std::string_view name{s, len};
+    if (name.find('.') != name.npos && name.front() != '.' && name.back() != '.' &&
+        name.find("..") == name.npos) {
+        for (size_t start = 0; start < len;) {
+            size_t stop = std::min(name.find('.', start), len);
+            segs.push_back(lam_make_symbol(vm, s + start, stop - start).as_symbol());
+            start = stop + 1;
+        }
+    }
+    size_t name_size = (len + 1 + alignof(lam_symbol*) - 1) & ~(alignof(lam_symbol*) - 1);
+    auto* d = callocPlus<lam_symbol>(vm, name_size + segs.size() * sizeof(lam_symbol*));
     d->type = lam_type::Symbol;
     d->len = len;
+    d->hash = hash;
+    d->nsegs = segs.size();
     memcpy(d + 1, s, len);
     reinterpret_cast<char*>(d + 1)[len] = 0;
+    memcpy(d->segs(), segs.data(), segs.size() * sizeof(lam_symbol*));
+    vm->symbols.insert(d);
     return {.uval = lam_u64(d) | lam_Magic::TagObj};
 }
 
@@ -274,15 +636,25 @@ lam_value lam_make_string(lam_vm* vm, const char* s, size_t n) {
     auto* d = callocPlus<lam_string>(vm, len + 1);
     d->type = lam_type::String;
     d->len = len;
+    d->data = reinterpret_cast<char*>(d + 1);
     memcpy(d + 1, s, len);
     reinterpret_cast<char*>(d + 1)[len] = 0;
     return {.uval = lam_u64(d) | lam_Magic::TagObj};
 }
 
+lam_value lam_make_string_view(lam_vm* vm, const char* s, size_t n) {
+    auto* d = callocPlus<lam_string>(vm, 0);
+    d->type = lam_type::String;
+    d->len = n;
+    d->data = s;
+    return {.uval = lam_u64(d) | lam_Magic::TagObj};
+}
+
 lam_value lam_make_bigint(lam_vm* vm, int i) {
     auto* d = callocPlus<lam_bigint>(vm, 0);
     d->type = lam_type::BigInt;
     mpz_init_set_si(d->mp, i);
+    lam_track_finalizer(vm, d);
     return {.uval = lam_u64(d) | lam_Magic::TagObj};
 }
 
@@ -299,6 +671,7 @@ lam_value lam_make_bigint(lam_vm* vm, mpz_t m) {
     d->type = lam_type::BigInt;
     static_assert(sizeof(d->mp) == 16);
     memcpy(d->mp, m, sizeof(d->mp));
+    lam_track_finalizer(vm, d);
     return {.uval = lam_u64(d) | lam_Magic::TagObj};
 }
 
@@ -311,39 +684,319 @@ lam_value lam_make_list_v(lam_vm* vm, const lam_value* values, size_t len) {
     return {.uval = lam_u64(d) | lam_Magic::TagObj};
 }
 
+lam_bytecode* lam_new_bytecode(lam_vm* vm,
+                               const lam_value* consts,
+                               size_t nconst,
+                               const std::uint32_t* code,
+                               size_t ncode,
+                               size_t max_stack) {
+    auto* d = callocPlus<lam_bytecode>(
+        vm, nconst * sizeof(lam_value) + ncode * sizeof(std::uint32_t));
+    d->type = lam_type::Bytecode;
+    d->nconst = nconst;
+    d->ncode = ncode;
+    d->max_stack = max_stack;
+    memcpy(d->consts(), consts, nconst * sizeof(lam_value));
+    memcpy(const_cast<std::uint32_t*>(d->code()), code, ncode * sizeof(std::uint32_t));
+    return d;
+}
+
+lam_value* lam_operand_stack::enter(size_t n) {
+    if (_chunks.empty()) {
+        _chunks.emplace_back();
+        _chunks.back().mem.resize(4096);
+    }
+    chunk* c = &_chunks[_cur];
+    if (c->top + n > c->mem.size()) {
+        _cur += 1;
+        if (_cur == _chunks.size()) {
+            _chunks.emplace_back();
+            _chunks.back().mem.resize(n > 4096 ? n : 4096);
+        }
+        c = &_chunks[_cur];
+        assert(c->top == 0);
+        if (c->mem.size() < n) {
+            c->mem.resize(n);
+        }
+    }
+    lam_value* window = c->mem.data() + c->top;
+    for (size_t i = 0; i < n; ++i) {
+        window[i] = lam_make_null();
+    }
+    c->top += n;
+    _windows.push_back({window, n});
+    return window;
+}
+
+void lam_operand_stack::leave(lam_value* window) {
+    chunk* c = &_chunks[_cur];
+    assert(window >= c->mem.data() && window <= c->mem.data() + c->top);
+    assert(_windows.back().base == window);
+    c->top = window - c->mem.data();
+    if (c->top == 0 && _cur > 0) {
+        _cur -= 1;
+    }
+    _windows.pop_back();
+    if (_clean >= _windows.size()) {  // the window below is topmost again
+        _clean = _windows.empty() ? 0 : _windows.size() - 1;
+    }
+}
+
 lam_env::lam_env(lam_vm* v) : lam_obj(lam_type::Environment), vm(v) {}
 
-struct lam_env_impl : lam_env {
-    inline void* operator new(std::size_t n, void* ptr) { return ptr; }
+// Group probing works on the 8 control bytes of a group as one word.
+static constexpr lam_u64 GroupLsb = 0x01010101'01010101;
+static constexpr lam_u64 GroupMsb = 0x80808080'80808080;
+
+static inline lam_u64 load_group(const std::uint8_t* ctrl) {
+    lam_u64 g;
+    memcpy(&g, ctrl, sizeof(g));
+    return g;
+}
+
+// Set the high bit of each byte which equals 'h2'. May also flag a byte above a real match,
+// callers compare the keys anyway.
+static inline lam_u64 match_group(lam_u64 group, lam_u64 h2) {
+    lam_u64 x = group ^ (GroupLsb * h2);
+    return (x - GroupLsb) & ~x & GroupMsb;
+}
+
+// Index of the first byte flagged in 'm', and 'm' without that flag.
+static inline size_t first_in_group(lam_u64 m) {
+    if constexpr (std::endian::native == std::endian::little) {
+        return size_t(std::countr_zero(m)) / 8;
+    } else {
+        return size_t(std::countl_zero(m)) / 8;
+    }
+}
+static inline lam_u64 drop_in_group(lam_u64 m, size_t i) {
+    if constexpr (std::endian::native == std::endian::little) {
+        return m & ~(lam_u64(0x80) << (8 * i));
+    } else {
+        return m & ~(lam_u64(0x80) << (56 - 8 * i));
+    }
+}
 
-    lam_env_impl(lam_vm* vm, lam_env* parent, const char* name)
-        : lam_env(vm), _parent{parent}, _name{name} {}
+// Top 7 bits select the control byte, the rest the group.
+static inline std::uint8_t ctrl_of(lam_u64 hash) {
+    return std::uint8_t(hash >> 57);
+}
 
-    struct string_hash {
-        using is_transparent = void;
-        [[nodiscard]] size_t operator()(const char* txt) const {
-            return std::hash<std::string_view>{}(txt);
+lam_value* lam_env_table::find(const lam_symbol* sym) const {
+    if (_count == 0) {
+        return nullptr;
+    }
+    size_t mask = _cap / GroupSize - 1;
+    size_t g = sym->hash & mask;
+    for (size_t step = 1;; ++step) {
+        lam_u64 group = load_group(_ctrl + g * GroupSize);
+        for (lam_u64 m = match_group(group, ctrl_of(sym->hash)); m;) {
+            size_t i = first_in_group(m);
+            entry& e = _entries[g * GroupSize + i];
+            if (e.key == sym) {
+                return &e.value;
+            }
+            m = drop_in_group(m, i);
         }
-        [[nodiscard]] size_t operator()(std::string_view txt) const {
-            return std::hash<std::string_view>{}(txt);
+        if (group & GroupMsb) {  // an empty slot ends the probe sequence
+            return nullptr;
         }
-        [[nodiscard]] size_t operator()(const std::string& txt) const {
-            return std::hash<std::string>{}(txt);
+        g = (g + step) & mask;  // triangular probing visits every group
+    }
+}
+
+lam_value* lam_env_table::insert(lam_vm* vm, lam_symbol* sym, bool* inserted) {
+    if (lam_value* v = find(sym)) {
+        *inserted = false;
+        return v;
+    }
+    if (8 * (_count + 1) > 7 * _cap) {
+        _grow(vm);
+    }
+    size_t mask = _cap / GroupSize - 1;
+    size_t g = sym->hash & mask;
+    for (size_t step = 1;; ++step) {
+        lam_u64 empty = load_group(_ctrl + g * GroupSize) & GroupMsb;
+        if (empty) {
+            size_t i = g * GroupSize + first_in_group(empty);
+            _ctrl[i] = ctrl_of(sym->hash);
+            _entries[i] = {sym, lam_make_null()};
+            _count += 1;
+            *inserted = true;
+            return &_entries[i].value;
         }
-    };
-    static lam_value _lookup(const char* symStr, const lam_env* startEnv);
-    std::unordered_map<std::string, lam_value, string_hash, std::equal_to<>> _map;
-    lam_env* _parent{nullptr};
-    const char* _name{nullptr};
-    bool _sealed{false};
-};
+        g = (g + step) & mask;
+    }
+}
+
+void lam_env_table::_grow(lam_vm* vm) {
+    lam_env_table old = *this;
+    _cap = old._cap ? 2 * old._cap : GroupSize;
+    _count = 0;
+    void* mem = vm->hooks->mem_alloc(_cap * (sizeof(entry) + 1));
+    _entries = static_cast<entry*>(mem);
+    _ctrl = reinterpret_cast<std::uint8_t*>(_entries + _cap);
+    memset(_ctrl, Empty, _cap);
+    bool inserted;
+    old.for_each([&](const entry& e) { *insert(vm, e.key, &inserted) = e.value; });
+    old.release(vm);
+}
+
+void lam_env_table::release(lam_vm* vm) {
+    if (_entries) {
+        vm->hooks->mem_free(_entries);
+    }
+    *this = {};
+}
 
 lam_env* lam_new_env(lam_vm* vm, lam_env* parent, const char* name) {
     assert(parent == nullptr || vm == static_cast<lam_env_impl*>(parent)->vm);
+    if (parent) {
+        lam_env_escapes(parent);
+    }
     auto* d = callocPlus<lam_env_impl>(vm, 0);
     return new (d) lam_env_impl(vm, parent, name);
 }
 
+lam_symbol* lam_env_impl::_slot_name(size_t i) const {
+    return i < _frame->num_args ? _frame->args()[i] : _frame->variadic;
+}
+
+lam_value* lam_env_impl::_find_slot(lam_symbol* sym) const {
+    for (size_t i = 0; i < _nslots; ++i) {
+        if (_slot_name(i) == sym) {
+            return const_cast<lam_env_impl*>(this)->slots() + i;
+        }
+    }
+    return nullptr;
+}
+
+lam_value* lam_env_impl::_find_captured(lam_symbol* sym) const {
+    if (_frame == nullptr || _frame->captures == nullptr) {
+        return nullptr;
+    }
+    lam_value* names = _frame->captures->first();
+    for (size_t i = 0; i < _frame->num_captured; ++i) {
+        if (names[i].as_symbol() == sym) {
+            return _frame->captured() + i;
+        }
+    }
+    return nullptr;
+}
+
+// Most callables take a few fixed arguments. Their invoke and call environment are specialized
+// for the arity, which copies the arguments without a loop or a check for a rest list.
+static constexpr size_t MaxFixedArgs = 4;
+
+template <size_t N, bool Pooled = false>
+static lam_env* new_fixed_call_env(lam_callable* call, lam_value* args) {
+    assert(call->num_args == N && call->variadic == nullptr && call->envsym == nullptr);
+    lam_vm* vm = call->env->vm;
+    void* d = nullptr;
+    if (Pooled) {
+        d = vm->frame_pool.alloc(sizeof(lam_env_impl) + N * sizeof(lam_value));
+    }
+    if (d == nullptr) {
+        d = callocPlus<lam_env_impl>(vm, N * sizeof(lam_value));
+    }
+    auto* inner = new (d) lam_env_impl(vm, call->env, nullptr);
+    inner->_frame = call;
+    inner->_nslots = N;
+    lam_value* slots = inner->slots();
+    for (size_t i = 0; i < N; ++i) {
+        slots[i] = args[i];
+    }
+    return inner;
+}
+
+using lam_new_fixed_env = lam_env*(lam_callable* call, lam_value* args);
+static constexpr lam_new_fixed_env* new_fixed_call_envs[MaxFixedArgs + 1] = {
+    &new_fixed_call_env<0>, &new_fixed_call_env<1>, &new_fixed_call_env<2>,
+    &new_fixed_call_env<3>, &new_fixed_call_env<4>};
+static constexpr lam_new_fixed_env* new_pooled_fixed_call_envs[MaxFixedArgs + 1] = {
+    &new_fixed_call_env<0, true>, &new_fixed_call_env<1, true>, &new_fixed_call_env<2, true>,
+    &new_fixed_call_env<3, true>, &new_fixed_call_env<4, true>};
+
+lam_env* lam_new_call_env(lam_callable* call, lam_value* args, size_t narg) {
+    assert(call->envsym == nullptr);
+    assert((narg == call->num_args) || (call->variadic && narg >= call->num_args));
+    if (call->variadic == nullptr && call->num_args <= MaxFixedArgs) {
+        return new_fixed_call_envs[call->num_args](call, args);
+    }
+    lam_vm* vm = call->env->vm;
+    size_t nslots = call->num_args + (call->variadic ? 1 : 0);
+    auto* d = callocPlus<lam_env_impl>(vm, nslots * sizeof(lam_value));
+    auto* inner = new (d) lam_env_impl(vm, call->env, nullptr);
+    inner->_frame = call;
+    inner->_nslots = nslots;
+    memcpy(inner->slots(), args, call->num_args * sizeof(lam_value));
+    if (call->variadic) {
+        inner->slots()[call->num_args] =
+            lam_make_list_v(vm, args + call->num_args, narg - call->num_args);
+    }
+    return inner;
+}
+
+lam_env* lam_new_pooled_call_env(lam_callable* call, lam_value* args, size_t narg) {
+    assert((narg == call->num_args) || (call->variadic && narg >= call->num_args));
+    if (call->code->escapes) {
+        return lam_new_call_env(call, args, narg);
+    }
+    if (call->variadic == nullptr && call->num_args <= MaxFixedArgs) {
+        return new_pooled_fixed_call_envs[call->num_args](call, args);
+    }
+    lam_vm* vm = call->env->vm;
+    size_t nslots = call->num_args + (call->variadic ? 1 : 0);
+    void* d = vm->frame_pool.alloc(sizeof(lam_env_impl) + nslots * sizeof(lam_value));
+    if (d == nullptr) {
+        return lam_new_call_env(call, args, narg);
+    }
+    auto* inner = new (d) lam_env_impl(vm, call->env, nullptr);
+    inner->_frame = call;
+    inner->_nslots = nslots;
+    memcpy(inner->slots(), args, call->num_args * sizeof(lam_value));
+    if (call->variadic) {
+        inner->slots()[call->num_args] =
+            lam_make_list_v(vm, args + call->num_args, narg - call->num_args);
+    }
+    return inner;
+}
+
+void lam_rebind_call_env(lam_env* env, lam_value* args, size_t narg) {
+    auto frame = static_cast<lam_env_impl*>(env);
+    lam_callable* call = frame->_frame;
+    assert(lam_can_rebind(frame));
+    assert((narg == call->num_args) || (call->variadic && narg >= call->num_args));
+    lam_vm* vm = env->vm;
+    lam_value* slots = frame->slots();
+    memcpy(slots, args, call->num_args * sizeof(lam_value));
+    if (call->variadic) {
+        slots[call->num_args] = lam_make_list_v(vm, args + call->num_args, narg - call->num_args);
+    }
+    if (vm->frame_pool.contains(frame)) {
+        vm->frame_pool.touch(frame);
+    } else {
+        for (size_t i = 0; i < frame->_nslots; ++i) {
+            lam_write_barrier(vm, frame, slots[i]);
+        }
+    }
+}
+
+lam_env* lam_escape_call_env(lam_env* env) {
+    lam_vm* vm = env->vm;
+    if (!vm->frame_pool.contains(env)) {
+        return env;
+    }
+    auto frame = static_cast<lam_env_impl*>(env);
+    auto* d = callocPlus<lam_env_impl>(vm, frame->_nslots * sizeof(lam_value));
+    auto* heap = new (d) lam_env_impl(vm, frame->_parent, frame->_name);
+    heap->_frame = frame->_frame;
+    heap->_nslots = frame->_nslots;
+    memcpy(heap->slots(), frame->slots(), frame->_nslots * sizeof(lam_value));
+    vm->frame_pool.release(frame);
+    return heap;
+}
+
 lam_value lam_make_env(lam_vm* vm, lam_env* parent, const char* name) {
     return {.uval = lam_u64(lam_new_env(vm, parent, name)) | lam_Magic::TagObj};
 }
@@ -353,11 +1006,11 @@ void lam_env::seal() {
     self->_sealed = true;
 }
 
-void lam_env::bind_multiple(const char* keys[],
+void lam_env::bind_multiple(lam_symbol* const keys[],
                             size_t nkeys,
                             lam_value* values,
                             size_t nvalues,
-                            const char* variadic) {
+                            lam_symbol* variadic) {
     auto self = static_cast<lam_env_impl*>(this);
     assert(!self->_sealed);
     assert((nvalues == nkeys) || (variadic && nvalues >= nkeys));
@@ -370,17 +1023,38 @@ void lam_env::bind_multiple(const char* keys[],
     }
 }
 
-void lam_env::bind(const char* name, lam_value value) {
+void lam_env::bind(lam_symbol* name, lam_value value) {
     auto self = static_cast<lam_env_impl*>(this);
     assert(!self->_sealed);
-    auto pair = self->_map.emplace(name, value);
-    assert(pair.second && "symbol already defined");
+    assert(self->_find_slot(name) == nullptr && "symbol already defined");
+    if (self->_map.empty()) {  // about to allocate the table
+        lam_track_finalizer(vm, self);
+    }
+    bool inserted;
+    *self->_map.insert(vm, name, &inserted) = value;
+    assert(inserted && "symbol already defined");
+    lam_write_barrier(vm, self, value);
+    vm->env_version += self->_cached;
 }
 
-void lam_env::bind_upsert(const char* name, lam_value value) {
+void lam_env::bind(const char* name, lam_value value) {
+    bind(lam_make_symbol(vm, name).as_symbol(), value);
+}
+
+void lam_env::bind_upsert(lam_symbol* name, lam_value value) {
     auto self = static_cast<lam_env_impl*>(this);
     assert(!self->_sealed);
-    self->_map[name] = value;
+    lam_write_barrier(vm, self, value);
+    vm->env_version += self->_cached;
+    if (lam_value* slot = self->_find_slot(name)) {
+        *slot = value;
+        return;
+    }
+    if (self->_map.empty()) {
+        lam_track_finalizer(vm, self);
+    }
+    bool inserted;
+    *self->_map.insert(vm, name, &inserted) = value;
 }
 
 void lam_env::bind_applicative(const char* name, lam_invoke b) {
@@ -395,7 +1069,7 @@ void lam_env::bind_applicative(const char* name, lam_invoke b) {
     d->num_args = 0;
     d->context = nullptr;
     lam_value v{.uval = lam_u64(d) | lam_Magic::TagObj};
-    self->_map.emplace(name, v);
+    bind(name, v);
 }
 
 void lam_env::bind_operative(const char* name, lam_invoke b, void* context) {
@@ -410,31 +1084,38 @@ void lam_env::bind_operative(const char* name, lam_invoke b, void* context) {
     d->num_args = 0;
     d->context = context;
     lam_value v{.uval = lam_u64(d) | lam_Magic::TagObj};
-    self->_map.emplace(name, v);
+    bind(name, v);
 }
 
-// symStr is a possibly-dotted identifier
-lam_value lam_env_impl::_lookup(const char* symStr, const lam_env* startEnv) {
-    std::string_view todo{symStr};
+// sym is a possibly-dotted identifier
+lam_value lam_env_impl::_lookup(lam_symbol* sym,
+                                const lam_env* startEnv,
+                                size_t first,
+                                bool cache) {
     auto env = static_cast<const lam_env_impl*>(startEnv);
-    while (1) {
-        // Extract 'cur' - the next segment of the dotted path
-        auto dot = todo.find('.', 0);
-        std::string_view cur = todo;
-        if (dot != std::string::npos) {
-            cur = cur.substr(0, dot);
-            todo.remove_prefix(dot + 1);
-        } else {  // end of path
-            todo = {};
-        }
-
+    // A path is looked up one segment at a time, each in the environment found by the previous.
+    lam_symbol** segs = &sym;
+    size_t nsegs = 1;
+    if (sym->nsegs) {
+        segs = sym->segs();
+        nsegs = sym->nsegs;
+    }
+    for (size_t i = first;;) {
         // Look up 'cur', return it if it's the last segment.
         // Otherwise update 'env' and loop for next segment.
+        lam_symbol* cur = segs[i];
         for (auto e = env;;) {
-            auto it = e->_map.find(cur);
-            if (it != e->_map.end()) {
-                lam_value v = it->second;
-                if (todo.empty()) {  // we're at the last dotted id
+            e->_cached |= cache;
+            const lam_value* found = e->_find_slot(cur);
+            if (found == nullptr) {
+                found = e->_map.find(cur);
+            }
+            if (found == nullptr) {
+                found = e->_find_captured(cur);
+            }
+            if (found) {
+                lam_value v = *found;
+                if (++i == nsegs) {  // we're at the last dotted id
                     return v;
                 } else {  // go to next dot
                     env = static_cast<lam_env_impl*>(v.as_env());
@@ -450,35 +1131,25 @@ lam_value lam_env_impl::_lookup(const char* symStr, const lam_env* startEnv) {
     }
 }
 
-lam_value lam_env::lookup(const char* sym) const {
+lam_value lam_env::lookup(lam_symbol* sym) const {
     return lam_env_impl::_lookup(sym, this);
 }
 
-static lam_type lam_coerce_numeric_types(lam_value& a, lam_value& b) {
-    auto at = a.type();
-    auto bt = b.type();
-    if ((at != lam_type::Double && at != lam_type::Int) ||
-        (bt != lam_type::Double && bt != lam_type::Int)) {
-        assert(false);
-    }
-    if (at == bt) {
-        return at;
-    }
-    if (at == lam_type::Double) {
-        b = lam_make_double(b.as_int());
-    } else {
-        a = lam_make_double(a.as_int());
+lam_value lam_env::lookup(const char* sym) const {
+    if (lam_symbol* s = lam_find_symbol(vm, sym)) {
+        return lam_env_impl::_lookup(s, this);
     }
-    return lam_type::Double;
+    return lam_make_error(vm, SymbolNotFound, "symbol not found");
 }
 
 static lam_value_or_tail_call invoke_applicative(lam_callable* call,
                                                  lam_env* env,
                                                  lam_value* args,
                                                  auto narg) {
-    assert(call->envsym == nullptr);
-    lam_env* inner = lam_new_env(env->vm, call->env, nullptr);
-    inner->bind_multiple((const char**)call->args(), call->num_args, args, narg, call->variadic);
+    lam_env* inner = lam_new_call_env(call, args, narg);
+    if (call->code) {
+        return lam_execute(call->code, inner);
+    }
     return {call->body, inner};
 }
 
@@ -487,13 +1158,112 @@ static lam_value_or_tail_call invoke_operative(lam_callable* call,
                                                lam_value* args,
                                                auto narg) {
     lam_env* inner = lam_new_env(env->vm, call->env, nullptr);
-    inner->bind_multiple((const char**)call->args(), call->num_args, args, narg, call->variadic);
+    inner->bind_multiple(call->args(), call->num_args, args, narg, call->variadic);
     assert(call->envsym);
+    lam_env_escapes(env);
     inner->bind(call->envsym, lam_make_value(env));
+    if (call->code) {
+        return lam_execute(call->code, inner);
+    }
     return {call->body, inner};
 }
 
-static bool truthy(lam_value v) {
+template <size_t N>
+static lam_value_or_tail_call invoke_applicative_fixed(lam_callable* call,
+                                                       lam_env* env,
+                                                       lam_value* args,
+                                                       size_t narg) {
+    assert(narg == N);
+    lam_env* inner = new_fixed_call_env<N>(call, args);
+    if (call->code) {
+        return lam_execute(call->code, inner);
+    }
+    return {call->body, inner};
+}
+
+template <size_t N>
+static lam_value_or_tail_call invoke_operative_fixed(lam_callable* call,
+                                                     lam_env* env,
+                                                     lam_value* args,
+                                                     size_t narg) {
+    assert(narg == N && call->num_args == N && call->variadic == nullptr);
+    lam_env* inner = lam_new_env(env->vm, call->env, nullptr);
+    lam_symbol** names = call->args();
+    for (size_t i = 0; i < N; ++i) {
+        inner->bind(names[i], args[i]);
+    }
+    assert(call->envsym);
+    lam_env_escapes(env);
+    inner->bind(call->envsym, lam_make_value(env));
+    if (call->code) {
+        return lam_execute(call->code, inner);
+    }
+    return {call->body, inner};
+}
+
+// Pick the invoke for a callable made by $define or $lambda once its arguments are known.
+static lam_invoke* select_invoke(lam_callable* call) {
+    static constexpr lam_invoke* applicatives[MaxFixedArgs + 1] = {
+        &invoke_applicative_fixed<0>, &invoke_applicative_fixed<1>, &invoke_applicative_fixed<2>,
+        &invoke_applicative_fixed<3>, &invoke_applicative_fixed<4>};
+    static constexpr lam_invoke* operatives[MaxFixedArgs + 1] = {
+        &invoke_operative_fixed<0>, &invoke_operative_fixed<1>, &invoke_operative_fixed<2>,
+        &invoke_operative_fixed<3>, &invoke_operative_fixed<4>};
+    bool operative = call->type == lam_type::Operative;
+    if (call->variadic || call->num_args > MaxFixedArgs) {
+        return operative ? static_cast<lam_invoke*>(&invoke_operative)
+                         : static_cast<lam_invoke*>(&invoke_applicative);
+    }
+    return operative ? operatives[call->num_args] : applicatives[call->num_args];
+}
+
+lam_value lam_make_lambda(lam_env* env,
+                          lam_value params,
+                          lam_value body,
+                          lam_bytecode* code,
+                          lam_list* captures,
+                          const lam_value* values) {
+    size_t numArgs{0};
+    lam_value* argp{nullptr};
+    lam_symbol* variadic{nullptr};
+    if (params.type() == lam_type::List) {
+        auto args = params.as_list();
+        numArgs = args->len;
+        argp = args->first();
+    } else if (params.type() == lam_type::Symbol) {
+        variadic = params.as_symbol();
+    } else {
+        assert(false && "expected list or symbol");
+    }
+    size_t numCaptured = captures ? captures->len : 0;
+    auto func = callocPlus<lam_callable>(
+        env->vm, numArgs * sizeof(lam_symbol*) + numCaptured * sizeof(lam_value));
+    func->type = lam_type::Applicative;
+    func->name = "lambda";
+    func->env = env;
+    lam_env_escapes(env);
+    func->body = body;
+    func->num_args = numArgs;
+    func->variadic = variadic;
+    func->invoke = select_invoke(func);
+    func->captures = captures;
+    func->num_captured = numCaptured;
+    lam_symbol** names = func->args();
+    for (int i = 0; i < numArgs; ++i) {
+        names[i] = argp[i].as_symbol();
+    }
+    if (numCaptured) {
+        memcpy(func->captured(), values, numCaptured * sizeof(lam_value));
+    }
+    if (code == nullptr && env->vm->compile) {
+        lam_scope scope{names, numArgs, variadic};
+        code = lam_compile(env->vm, body, &scope);
+    }
+    func->code = code;
+    return lam_make_value(func);
+}
+
+bool lam_truthy(lam_value v) {
     if ((v.uval & lam_Magic::Mask) == lam_Magic::TagInt) {
         return unsigned(v.uval) != 0;
     } else if ((v.uval & lam_Magic::Mask) == lam_Magic::TagObj) {
@@ -559,7 +1329,8 @@ void lam_print(lam_vm* vm, lam_value val, const char* end) {
             next = std::format_to_n(out, sizeof(out), ":{}", val.as_symbol()->val());
             break;
         case lam_type::String:
-            next = std::format_to_n(out, sizeof(out), "{}", val.as_string()->val());
+            next = std::format_to_n(out, sizeof(out), "{}",
+                                    std::string_view{val.as_string()->val(), val.as_string()->len});
             break;
         case lam_type::List: {
             vm->hooks->output("(", 1);
@@ -594,20 +1365,154 @@ void lam_print(lam_vm* vm, lam_value val, const char* end) {
     }
 }
 
+lam_value_or_tail_call lam_apply(lam_callable* call, lam_env* env, lam_value* args, size_t narg) {
+    return call->invoke(call, env, args, narg);
+}
+
 lam_value lam_eval_call(lam_callable* call, lam_env* env, lam_value* args, size_t narg) {
-    auto ret = call->invoke(call, env, args, narg);
+    auto ret = lam_apply(call, env, args, narg);
     if (ret.env == nullptr) {
         return ret.value;
     }
     return lam_eval(ret.value, ret.env);
 }
 
-static constexpr int combine_numeric_types(lam_type xt, lam_type yt) {
-    assert(xt == lam_type::Int || xt == lam_type::Double || xt == lam_type::BigInt);
-    assert(yt == lam_type::Int || yt == lam_type::Double || yt == lam_type::BigInt);
-    int xm = xt == lam_type::Int ? 0 : xt == lam_type::Double ? 1 : /*xt == lam_type::BigInt*/ 2;
-    int ym = yt == lam_type::Int ? 0 : yt == lam_type::Double ? 1 : /*yt == lam_type::BigInt*/ 2;
-    return (int(xm) << 2) | int(ym);
+// The numeric tower of the arithmetic builtins: an int which overflows becomes a bigint, an int
+// with a bigint is a bigint, and anything with a double is a double.
+
+static bool numeric(lam_type t) {
+    return t == lam_type::Int || t == lam_type::BigInt || t == lam_type::Double;
+}
+
+static double numeric_to_double(lam_value v, lam_type t) {
+    switch (t) {
+        case lam_type::Int:
+            return double(v.as_int());
+        case lam_type::BigInt:
+            return mpz_get_d(v.as_bigint()->mp);
+        default:
+            return v.dval;
+    }
+}
+
+// The bigint of 'v', which is an int or a bigint. 'tmp' holds a converted int.
+static mpz_srcptr numeric_to_mpz(lam_value v, lam_type t, mpz_t tmp) {
+    if (t == lam_type::BigInt) {
+        return v.as_bigint()->mp;
+    }
+    mpz_set_si(tmp, v.as_int());
+    return tmp;
+}
+
+// 'a Op b' on bigints.
+template <lam_arith Op>
+static lam_value arith_bigints(lam_vm* vm, mpz_srcptr a, mpz_srcptr b) {
+    if constexpr (Op == lam_arith::Div) {
+        return lam_make_double(mpz_get_d(a) / mpz_get_d(b));
+    } else if constexpr (Op >= lam_arith::Lt) {
+        return lam_make_int(lam_compare<Op>(mpz_cmp(a, b), 0));
+    } else {
+        if constexpr (Op == lam_arith::Mod) {
+            if (mpz_sgn(b) == 0) {
+                return lam_make_error(vm, DivisionByZero, "(mod x 0)");
+            }
+        }
+        mpz_t r;
+        mpz_init(r);
+        if constexpr (Op == lam_arith::Add) {
+            mpz_add(r, a, b);
+        } else if constexpr (Op == lam_arith::Sub) {
+            mpz_sub(r, a, b);
+        } else if constexpr (Op == lam_arith::Mul) {
+            mpz_mul(r, a, b);
+        } else {
+            mpz_fdiv_r(r, a, b);
+        }
+        return lam_make_bigint(vm, r);
+    }
+}
+
+// 'a Op b' on a bigint and an int, or 'b Op a' if 'swapped', without a bigint for 'b'.
+template <lam_arith Op>
+static lam_value arith_bigint_int(lam_vm* vm, mpz_srcptr a, long b, bool swapped) {
+    if constexpr (Op >= lam_arith::Lt) {
+        int c = mpz_cmp_si(a, b);
+        return lam_make_int(swapped ? lam_compare<Op>(0, c) : lam_compare<Op>(c, 0));
+    } else {
+        static_assert(Op == lam_arith::Add || Op == lam_arith::Sub || Op == lam_arith::Mul);
+        mpz_t r;
+        mpz_init(r);
+        if constexpr (Op == lam_arith::Mul) {
+            mpz_mul_si(r, a, b);
+        } else {
+            unsigned long m = b >= 0 ? b : 0ul - (unsigned long)b;
+            if ((Op == lam_arith::Add) == (b >= 0)) {
+                mpz_add_ui(r, a, m);
+            } else {
+                mpz_sub_ui(r, a, m);
+            }
+            if (Op == lam_arith::Sub && swapped) {  // b - a is -(a - b)
+                mpz_neg(r, r);
+            }
+        }
+        return lam_make_bigint(vm, r);
+    }
+}
+
+// (Op x y) The builtin for each lam_arith. Calls have done the ints and doubles already, unless
+// the builtin is called some other way, e.g. by mapreduce.
+template <lam_arith Op>
+static lam_value_or_tail_call arith_builtin(lam_callable* call,
+                                            lam_env* env,
+                                            lam_value* a,
+                                            size_t n) {
+    if (n != 2) {
+        return lam_make_error(env->vm, WrongNumberOfArguments, "(op x y)");
+    }
+    lam_value x = a[0];
+    lam_value y = a[1];
+    lam_value r;
+    if (lam_arith_inline<Op>(x, y, r)) {
+        return r;
+    }
+    lam_type xt = x.type();
+    lam_type yt = y.type();
+    if (xt == lam_type::BigInt && yt == lam_type::BigInt) {
+        return arith_bigints<Op>(env->vm, x.as_bigint()->mp, y.as_bigint()->mp);
+    }
+    if constexpr (Op != lam_arith::Div && Op != lam_arith::Mod) {
+        if (xt == lam_type::BigInt && yt == lam_type::Int) {
+            return arith_bigint_int<Op>(env->vm, x.as_bigint()->mp, y.as_int(), false);
+        } else if (xt == lam_type::Int && yt == lam_type::BigInt) {
+            return arith_bigint_int<Op>(env->vm, y.as_bigint()->mp, x.as_int(), true);
+        }
+    }
+    if (!numeric(xt) || !numeric(yt)) {
+        return lam_make_error(env->vm, NonNumericArguments, "(op x y) needs numbers");
+    }
+    if (xt == lam_type::Double || yt == lam_type::Double) {
+        if constexpr (Op >= lam_arith::Lt) {  // exactly, where a bigint has no double
+            if (xt == lam_type::BigInt) {
+                return lam_make_int(lam_compare<Op>(mpz_cmp_d(x.as_bigint()->mp, y.dval), 0));
+            } else if (yt == lam_type::BigInt) {
+                return lam_make_int(lam_compare<Op>(0, mpz_cmp_d(y.as_bigint()->mp, x.dval)));
+            }
+        }
+        double b = numeric_to_double(y, yt);
+        if (Op == lam_arith::Mod && b == 0) {
+            return lam_make_error(env->vm, DivisionByZero, "(mod x 0)");
+        }
+        return lam_arith_doubles<Op>(numeric_to_double(x, xt), b);
+    }
+    // Ints which overflowed, or a quotient or remainder of an int and a bigint.
+    mpz_t tx;
+    mpz_t ty;
+    mpz_init(tx);
+    mpz_init(ty);
+    r = arith_bigints<Op>(env->vm, numeric_to_mpz(x, xt, tx), numeric_to_mpz(y, yt, ty));
+    mpz_clear(tx);
+    mpz_clear(ty);
+    return r;
 }
 
 lam_env* lam_make_env_builtin(lam_vm* vm) {
@@ -650,47 +1555,57 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
             if (lhs.type() == lam_type::Symbol) {  // ($define sym value)
                 assert(numCallArgs == 2);
                 auto sym = reinterpret_cast<lam_symbol*>(lhs.uval & ~lam_Magic::Mask);
+                lam_vm* vm = env->vm;
+                lam_value* roots = vm->operands.enter(1);
+                roots[0] = lam_make_value(env);
                 auto r = lam_eval(callArgs[1], env);
-                env->bind(sym->val(), r);
+                env = roots[0].as_env();
+                vm->operands.leave(roots);
+                env->bind(sym, r);
             } else if (lhs.type() == lam_type::List) {  // ($define (applicative ...) body) or
                                                         // ($define ($operative ...) env body)
                 auto argsList = reinterpret_cast<lam_list*>(lhs.uval & ~lam_Magic::Mask);
-                const char* name = argsList->at(0).as_symbol()->val();
+                lam_symbol* namesym = argsList->at(0).as_symbol();
+                const char* name = namesym->val();
                 std::span<lam_value> fnargs{argsList->first() + 1,
                                             argsList->len - 1};  // drop sym from args list
-                const char* variadic{nullptr};
+                lam_symbol* variadic{nullptr};
 
                 // variadic?
                 if (fnargs.size() >= 2 && fnargs[fnargs.size() - 2].as_symbol()->val()[0] == '.') {
-                    variadic = fnargs[fnargs.size() - 1].as_symbol()->val();
+                    variadic = fnargs[fnargs.size() - 1].as_symbol();
                     fnargs = fnargs.subspan(0, fnargs.size() - 2);
                 }
-                auto func = callocPlus<lam_callable>(
-                    env->vm, fnargs.size() * sizeof(char*));  // TODO intern names
+                auto func = callocPlus<lam_callable>(env->vm, fnargs.size() * sizeof(lam_symbol*));
                 bool operative = name[0] == '$';
                 if (operative) {
                     assert(numCallArgs == 3);
                     func->type = lam_type::Operative;
-                    func->invoke = &invoke_operative;
                     func->body = callArgs[2];
-                    func->envsym = callArgs[1].as_symbol()->val();
+                    func->envsym = callArgs[1].as_symbol();
                 } else {
                     assert(numCallArgs == 2);
                     func->type = operative ? lam_type::Operative : lam_type::Applicative;
-                    func->invoke = &invoke_applicative;
                     func->body = callArgs[1];
                     func->envsym = nullptr;
                 }
                 func->name = name;
                 func->env = env;
+                lam_env_escapes(env);
                 func->num_args = fnargs.size();
                 func->variadic = variadic;
-                char** names = func->args();
+                func->invoke = select_invoke(func);
+                lam_symbol** names = func->args();
                 for (size_t i = 0; i < fnargs.size(); ++i) {
-                    names[i] = const_cast<char*>(fnargs[i].as_symbol()->val());
+                    names[i] = fnargs[i].as_symbol();
+                }
+                if (env->vm->compile) {
+                    // Operative arguments are bound by name, so only applicatives get a scope.
+                    lam_scope scope{names, fnargs.size(), variadic};
+                    func->code = lam_compile(env->vm, func->body, operative ? nullptr : &scope);
                 }
                 lam_value y = {.uval = lam_u64(func) | lam_Magic::TagObj};
-                env->bind(name, y);
+                env->bind(namesym, y);
             } else {
                 assert(false);
             }
@@ -705,36 +1620,7 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
             if (n != 2) {
                 return lam_make_error(env->vm, WrongNumberOfArguments, "($lambda args body)");
             }
-            auto lhs = a[0];
-            auto rhs = a[1];
-            size_t numArgs{0};
-            lam_value* argp{nullptr};
-            const char* variadic{nullptr};
-            if (lhs.type() == lam_type::List) {
-                auto args = lhs.as_list();
-                numArgs = args->len;
-                argp = args->first();
-            } else if (lhs.type() == lam_type::Symbol) {
-                variadic = lhs.as_symbol()->val();
-            } else {
-                assert(false && "expected list or symbol");
-            }
-            auto func =
-                callocPlus<lam_callable>(env->vm, numArgs * sizeof(char*));  // TODO intern names
-            func->type = lam_type::Applicative;
-            func->invoke = &invoke_applicative;
-            func->name = "lambda";
-            func->env = env;
-            func->body = rhs;
-            func->num_args = numArgs;
-            func->variadic = variadic;
-            char** names = func->args();
-            for (int i = 0; i < numArgs; ++i) {
-                auto sym = argp[i].as_symbol();
-                names[i] = const_cast<char*>(sym->val());
-            }
-            lam_value y = {.uval = lam_u64(func) | lam_Magic::TagObj};
-            return y;
+            return lam_make_lambda(env, a[0], a[1], nullptr);
         });
 
     ret->bind_operative(
@@ -742,8 +1628,13 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         "$if", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n >= 2);
             assert(n <= 3);
+            lam_vm* vm = env->vm;
+            lam_value* roots = vm->operands.enter(1);
+            roots[0] = lam_make_value(env);
             auto cond = lam_eval(a[0], env);
-            if (truthy(cond)) {
+            env = roots[0].as_env();
+            vm->operands.leave(roots);
+            if (lam_truthy(cond)) {
                 return lam_value_or_tail_call(a[1], env);
             } else if (n == 3) {
                 return lam_value_or_tail_call(a[2], env);
@@ -758,12 +1649,16 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         "$module", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n >= 1);
             auto modname = a[0].as_symbol();
-            lam_env* inner = lam_new_env(env->vm, env, modname->val());
+            lam_vm* vm = env->vm;
+            lam_value* roots = vm->operands.enter(2);  // the environment and the module
+            roots[0] = lam_make_value(env);
+            roots[1] = lam_make_value(lam_new_env(vm, env, modname->val()));
             lam_value r = lam_make_null();
             for (size_t i = 1; i < n; i += 1) {
-                r = lam_eval(a[i], inner);
+                r = lam_eval(a[i], roots[1].as_env());
             }
-            env->bind(modname->val(), lam_make_value(inner));
+            roots[0].as_env()->bind(modname, roots[1]);
+            vm->operands.leave(roots);
             return r;
         });
 
@@ -772,17 +1667,18 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         "$import", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n == 1);
             auto modname = a[0].as_symbol();
-            auto it = env->vm->imports.find(modname->val());
-            if (it == env->vm->imports.end()) {
-                lam_code result = env->vm->hooks->import(env->vm, modname->val());
+            lam_vm* vm = env->vm;  // 'env' may move while the host imports
+            auto it = vm->imports.find(modname->val());
+            if (it == vm->imports.end()) {
+                lam_code result = vm->hooks->import(vm, modname->val());
                 if (result == lam_code::Ok) {
-                    return env->vm->stack.back();
+                    return vm->stack.back();
                 } else {
-                    return lam_make_error(env->vm, ImportNotFound, "result.msg");
+                    return lam_make_error(vm, ImportNotFound, "result.msg");
                 }
             } else {
                 lam_value m = it->second;
-                env->bind(modname->val(), m);
+                env->bind(modname, m);
                 return m;
             }
         });
@@ -800,9 +1696,17 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         // operative to get an opportunity to implement tail call optimization.
         "begin", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n >= 1);
+            if (n == 1) {
+                return {a[0], env};
+            }
+            lam_vm* vm = env->vm;
+            lam_value* roots = vm->operands.enter(1);
+            roots[0] = lam_make_value(env);
             for (size_t i = 0; i < n - 1; ++i) {
-                lam_eval(a[i], env);
+                lam_eval(a[i], roots[0].as_env());
             }
+            env = roots[0].as_env();
+            vm->operands.leave(roots);
             return {a[n - 1], env};  // tail call
         });
 
@@ -811,26 +1715,80 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         // ($let (name0 val0 name1.. val1..)) Bind pairs in the current environment
         "$let", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n >= 1);
-            lam_env* inner = (n == 1) ? env : lam_new_env(env->vm, env, nullptr);
+            lam_vm* vm = env->vm;
+            lam_value* roots = vm->operands.enter(2);  // the environment and the inner one
+            roots[0] = lam_make_value(env);
+            roots[1] = (n == 1) ? roots[0] : lam_make_value(lam_new_env(vm, env, nullptr));
             lam_list* locals = a[0].as_list();
             assert(locals);
             assert(locals->len % 2 == 0);
             for (size_t i = 0; i < locals->len; i += 2) {
+                auto v = lam_eval(locals->at(i + 1), roots[1].as_env());
+                locals = a[0].as_list();
                 auto k = locals->at(i + 0);
                 auto s = k.as_symbol();
                 assert(s);
-                auto v = lam_eval(locals->at(i + 1), inner);
-                inner->bind(s->val(), v);
+                roots[1].as_env()->bind(s, v);
             }
 
-            if (n == 1) {
-                return lam_make_null();
-            } else {
+            lam_value_or_tail_call r = lam_make_null();
+            if (n > 1) {
                 for (size_t i = 1; i < n - 1; ++i) {
-                    lam_eval(a[i], env);
+                    lam_eval(a[i], roots[0].as_env());
+                }
+                r = {a[n - 1], roots[1].as_env()};  // tail call
+            }
+            vm->operands.leave(roots);
+            return r;
+        });
+
+    ret->bind_operative(
+        // ($loop (name0 init0 name1.. init1..) cond (step0 step1..) result) Bind pairs as $let
+        // does, then while cond is true evaluate all the steps and assign them to the names in
+        // order. Evaluate result with the final bindings.
+        // The bindings are updated in place, unless a closure or (getenv) may have kept them.
+        "$loop", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
+            if (n != 4) {
+                return lam_make_error(env->vm, WrongNumberOfArguments,
+                                      "($loop (name init..) cond (step..) result)");
+            }
+            lam_vm* vm = env->vm;
+            lam_list* locals = a[0].as_list();
+            assert(locals && locals->len % 2 == 0);
+            size_t count = locals->len / 2;
+            assert(a[2].as_list() && a[2].as_list()->len == count);
+            // The environment, the one of the bindings and the next values of the bindings.
+            lam_value* roots = vm->operands.enter(2 + count);
+            roots[0] = lam_make_value(env);
+            roots[1] = lam_make_value(lam_new_env(vm, env, nullptr));
+            lam_value* next = roots + 2;
+            for (size_t i = 0; i < count; ++i) {
+                auto v = lam_eval(a[0].as_list()->at(2 * i + 1), roots[1].as_env());
+                roots[1].as_env()->bind(a[0].as_list()->at(2 * i).as_symbol(), v);
+            }
+            while (lam_truthy(lam_eval(a[1], roots[1].as_env()))) {
+                for (size_t i = 0; i < count; ++i) {
+                    next[i] = lam_eval(a[2].as_list()->at(i), roots[1].as_env());
+                }
+                lam_env* inner = roots[1].as_env();
+                bool kept = static_cast<lam_env_impl*>(inner)->_escaped;
+                if (kept) {
+                    inner = lam_new_env(vm, roots[0].as_env(), nullptr);
+                    roots[1] = lam_make_value(inner);
+                }
+                locals = a[0].as_list();
+                for (size_t i = 0; i < count; ++i) {
+                    auto s = locals->at(2 * i).as_symbol();
+                    if (kept) {
+                        inner->bind(s, next[i]);
+                    } else {
+                        inner->bind_upsert(s, next[i]);
+                    }
                 }
-                return {a[n - 1], inner};  // tail call
             }
+            lam_env* inner = roots[1].as_env();
+            vm->operands.leave(roots);
+            return {a[3], inner};  // tail call
         });
 
     ret->bind_applicative(
@@ -852,6 +1810,7 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         // (getenv) Return the current environment
         "getenv", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n == 0);
+            lam_env_escapes(env);
             return lam_make_value(env);
         });
 
@@ -896,241 +1855,175 @@ lam_env* lam_make_env_builtin(lam_vm* vm) {
         "mapreduce",
         [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
             assert(n == 3);
-            lam_callable* mapfunc = a[0].as_callable();
-            lam_callable* redfunc = a[1].as_callable();
-            lam_list* lst = a[2].as_list();
-            assert(lst->len >= 1);
-            lam_value accum{lam_eval_call(mapfunc, env, lst->first(), 1)};
-            for (size_t i = 1; i < lst->len; ++i) {
-                lam_value val = lam_eval_call(mapfunc, env, lst->first() + i, 1);
-                lam_value args[] = {accum, val};
-                accum = lam_eval_call(redfunc, env, args, 2);
+            lam_vm* vm = env->vm;
+            assert(a[2].as_list()->len >= 1);
+            // The environment, the argument of the map function, then the accumulator and the
+            // mapped value, which are the arguments of the reduce function.
+            lam_value* roots = vm->operands.enter(4);
+            roots[0] = lam_make_value(env);
+            roots[1] = a[2].as_list()->at(0);
+            roots[2] = lam_eval_call(a[0].as_callable(), env, roots + 1, 1);
+            for (size_t i = 1; i < a[2].as_list()->len; ++i) {
+                roots[1] = a[2].as_list()->at(i);
+                roots[3] = lam_eval_call(a[0].as_callable(), roots[0].as_env(), roots + 1, 1);
+                roots[2] = lam_eval_call(a[1].as_callable(), roots[0].as_env(), roots + 2, 2);
             }
+            lam_value accum = roots[2];
+            vm->operands.leave(roots);
             return accum;
         });
 
-    ret->bind_applicative(
-        "*", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
-            assert(n == 2);
-            lam_value x = a[0];
-            lam_value y = a[1];
-            lam_type xt = x.type();
-            lam_type yt = y.type();
-            switch (combine_numeric_types(xt, yt)) {
-                case combine_numeric_types(lam_type::Double, lam_type::Double):
-                    return lam_make_double(x.dval * y.dval);
-                case combine_numeric_types(lam_type::Double, lam_type::Int):
-                    return lam_make_double(x.dval * double(y.as_int()));
-                case combine_numeric_types(lam_type::Double, lam_type::BigInt):
-                    assert(false);
-                    return lam_value{};
-
-                case combine_numeric_types(lam_type::Int, lam_type::Double):
-                    return lam_make_double(double(x.as_int()) * y.dval);
-                case combine_numeric_types(lam_type::Int, lam_type::Int):
-                    return lam_make_int(x.as_int() * y.as_int());
-                case combine_numeric_types(lam_type::Int, lam_type::BigInt): {
-                    mpz_t r;
-                    mpz_init(r);
-                    mpz_mul_si(r, y.as_bigint()->mp, x.as_int());
-                    return lam_make_bigint(env->vm, r);
-                }
-
-                case combine_numeric_types(lam_type::BigInt, lam_type::Double):
-                    assert(false);
-                    break;
-                case combine_numeric_types(lam_type::BigInt, lam_type::Int): {
-                    mpz_t r;
-                    mpz_init(r);
-                    mpz_mul_si(r, x.as_bigint()->mp, y.as_int());
-                    return lam_make_bigint(env->vm, r);
-                } break;
-                case combine_numeric_types(lam_type::BigInt, lam_type::BigInt): {
-                    mpz_t r;
-                    mpz_init(r);
-                    mpz_mul(r, x.as_bigint()->mp, y.as_bigint()->mp);
-                    return lam_make_bigint(env->vm, r);
-                }
-                default:
-                    assert(false);
-            }
-            return lam_value{};
-            /*assert(n == 2);
-            switch (lam_env::coerce_numeric_types(a[0], a[1])) {
-                case lam_type::Double:
-                    return lam_make_double(a[0].dval * a[1].dval);
-                case lam_type::Int:
-                    return lam_make_int(a[0].as_int() * a[1].as_int());
-                case lam_type::BigInt: {
-                    mpz_t r;
-                    mpz_init(r);
-                    mpz_mul(r, a[0].as_bigint()->mp, a[1].as_bigint()->mp);
-                    return lam_make_bigint(r);
-                }
-                default:
-                    assert(false);
-                    return lam_value{};
-            }*/
-        });
-
-    ret->bind_applicative(
-        "+", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
-            assert(n == 2);
-            switch (lam_coerce_numeric_types(a[0], a[1])) {
-                case lam_type::Double:
-                    return lam_make_double(a[0].dval + a[1].dval);
-                case lam_type::Int:
-                    return lam_make_int(a[0].as_int() + a[1].as_int());
-                default:
-                    assert(false);
-                    return lam_value{};
-            }
-        });
-
-    ret->bind_applicative(
-        "-", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
-            assert(n == 2);
-            lam_value x = a[0];
-            lam_value y = a[1];
-            lam_type xt = x.type();
-            lam_type yt = y.type();
-            switch (combine_numeric_types(xt, yt)) {
-                case combine_numeric_types(lam_type::Double, lam_type::Double):
-                    return lam_make_double(x.dval - y.dval);
-                case combine_numeric_types(lam_type::Double, lam_type::Int):
-                    return lam_make_double(x.dval - double(y.as_int()));
-                case combine_numeric_types(lam_type::Double, lam_type::BigInt):
-                    assert(false);
-                    return lam_value{};
-
-                case combine_numeric_types(lam_type::Int, lam_type::Double):
-                    return lam_make_double(double(x.as_int()) - y.dval);
-                case combine_numeric_types(lam_type::Int, lam_type::Int):
-                    return lam_make_int(x.as_int() - y.as_int());
-                case combine_numeric_types(lam_type::Int, lam_type::BigInt):
-                    assert(false);
-                    // return lam_make_bigint(x.as_int() - y.as_int());
-                    // c = mpz_cmp_si(y.as_bigint()->mp, x.as_int()) >= 0;
-                    return lam_value{};
-
-                case combine_numeric_types(lam_type::BigInt, lam_type::Double):
-                    assert(false);
-                    break;
-                case combine_numeric_types(lam_type::BigInt, lam_type::Int): {
-                    mpz_t r;
-                    mpz_init(r);
-                    long z = y.as_int();
-                    if (z >= 0) {
-                        mpz_sub_ui(r, x.as_bigint()->mp, z);
-                    } else {
-                        mpz_add_ui(r, x.as_bigint()->mp, -z);
-                    }
-                    return lam_make_bigint(env->vm, r);
-                }
-                case combine_numeric_types(lam_type::BigInt, lam_type::BigInt): {
-                    mpz_t r;
-                    mpz_init(r);
-                    mpz_sub(r, x.as_bigint()->mp, y.as_bigint()->mp);
-                    return lam_make_bigint(env->vm, r);
-                }
-                default:
-                    assert(false);
-            }
-            return lam_value{};
-        });
-
-    ret->bind_applicative(
-        "/", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
-            assert(n == 2);
-            assert(a[0].type() == lam_type::Double);  // TODO
-            assert(a[1].type() == lam_type::Double);
-            return lam_make_double(a[0].dval / a[1].dval);
-        });
-
-    ret->bind_applicative(
-        "<=", [](lam_callable* call, lam_env* env, auto a, auto n) -> lam_value_or_tail_call {
-            assert(n == 2);
-            lam_value x = a[0];
-            lam_value y = a[1];
-            lam_type xt = x.type();
-            lam_type yt = y.type();
-            int c = 0;
-            switch (combine_numeric_types(xt, yt)) {
-                case combine_numeric_types(lam_type::Double, lam_type::Double):
-                    c = x.dval <= y.dval;
-                    break;
-                case combine_numeric_types(lam_type::Double, lam_type::Int):
-                    c = x.dval <= double(y.as_int());
-                    break;
-                case combine_numeric_types(lam_type::Double, lam_type::BigInt):
-                    c = mpz_cmp_d(y.as_bigint()->mp, x.as_double()) >= 0;
-                    break;
-
-                case combine_numeric_types(lam_type::Int, lam_type::Double):
-                    c = double(x.as_int()) <= y.dval;
-                    break;
-                case combine_numeric_types(lam_type::Int, lam_type::Int):
-                    c = x.as_int() <= y.as_int();
-                    break;
-                case combine_numeric_types(lam_type::Int, lam_type::BigInt):
-                    c = mpz_cmp_si(y.as_bigint()->mp, x.as_int()) >= 0;
-                    break;
-
-                case combine_numeric_types(lam_type::BigInt, lam_type::Double):
-                    c = mpz_cmp_d(x.as_bigint()->mp, y.as_double()) <= 0;
-                    break;
-                case combine_numeric_types(lam_type::BigInt, lam_type::Int):
-                    c = mpz_cmp_si(x.as_bigint()->mp, y.as_int()) <= 0;
-                    break;
-                case combine_numeric_types(lam_type::BigInt, lam_type::BigInt):
-                    c = mpz_cmp(x.as_bigint()->mp, y.as_bigint()->mp) <= 0;
-                    break;
-                default:
-                    assert(false);
-                    return lam_value{};
-            }
-            return lam_make_int(c);
-        });
+    // Arithmetic and comparison of two numbers, see lam_arith.
+    struct {
+        const char* name;
+        lam_arith op;
+        lam_invoke* invoke;
+    } ariths[] = {
+        {"+", lam_arith::Add, arith_builtin<lam_arith::Add>},
+        {"-", lam_arith::Sub, arith_builtin<lam_arith::Sub>},
+        {"*", lam_arith::Mul, arith_builtin<lam_arith::Mul>},
+        {"/", lam_arith::Div, arith_builtin<lam_arith::Div>},
+        {"mod", lam_arith::Mod, arith_builtin<lam_arith::Mod>},
+        {"<", lam_arith::Lt, arith_builtin<lam_arith::Lt>},
+        {"<=", lam_arith::Le, arith_builtin<lam_arith::Le>},
+        {">", lam_arith::Gt, arith_builtin<lam_arith::Gt>},
+        {">=", lam_arith::Ge, arith_builtin<lam_arith::Ge>},
+        {"=", lam_arith::Eq, arith_builtin<lam_arith::Eq>},
+    };
+    for (auto& a : ariths) {
+        ret->bind_applicative(a.name, a.invoke);
+        ret->lookup(a.name).as_callable()->arith = a.op;
+    }
 
     ret->bind("null", lam_make_null());
+    vm->forms.if_ = ret->lookup("$if").as_callable();
+    vm->forms.begin = ret->lookup("begin").as_callable();
+    vm->forms.quote = ret->lookup("$quote").as_callable();
+    vm->forms.lambda = ret->lookup("$lambda").as_callable();
+    // Compiled code moves its frame out of the pool before calling these.
+    for (const char* name : {"eval", "getenv", "mapreduce"}) {
+        ret->lookup(name).as_callable()->keeps_env = true;
+    }
     ret->seal();
     return lam_new_env(vm, ret, nullptr);
 }
 
+// Whether 'v' is a symbol or a number or constant, which lam_eval looks up or returns as is
+// without reaching a safe point.
+static inline bool is_atom(lam_value v) {
+    return (v.uval & lam_Magic::Mask) != lam_Magic::TagObj ||
+           reinterpret_cast<lam_obj*>(v.uval & ~lam_Magic::Mask)->type == lam_type::Symbol;
+}
+
+// lam_eval of the head or an argument of a call, without its loop for atoms.
+static inline lam_value eval_operand(lam_value v, lam_env* env) {
+    if ((v.uval & lam_Magic::Mask) != lam_Magic::TagObj) {
+        return v;
+    }
+    auto obj = reinterpret_cast<lam_obj*>(v.uval & ~lam_Magic::Mask);
+    if (obj->type == lam_type::Symbol) {
+        return env->lookup(static_cast<lam_symbol*>(obj));
+    }
+    return lam_eval(v, env);
+}
+
 lam_value lam_eval(lam_value val, lam_env* env) {
-    // TODO    ugc_collect(&instance.gc);
+    lam_vm* vm = env->vm;
+    // Whether 'env' is the frame of an applicative which this loop tail called. Nothing else can
+    // refer to it unless it escaped, so a self tail call may bind its arguments in place.
+    bool owned = false;
     while (true) {
+        if (lam_at_safe_point(vm)) {  // 'val' and 'env' are all this call holds on to
+            lam_value* roots = vm->operands.enter(2);
+            roots[0] = val;
+            roots[1] = lam_make_value(env);
+            lam_gc_safe_point(vm);
+            val = roots[0];
+            env = roots[1].as_env();
+            vm->operands.leave(roots);
+        }
         switch (val.uval & lam_Magic::Mask) {
             case lam_Magic::TagObj: {
                 lam_obj* obj = reinterpret_cast<lam_obj*>(val.uval & ~lam_Magic::Mask);
                 switch (obj->type) {
                     case lam_type::Symbol: {
                         auto sym = static_cast<lam_symbol*>(obj);
-                        return env->lookup(sym->val());
+                        return env->lookup(sym);
                     }
                     case lam_type::List: {
                         auto list = static_cast<lam_list*>(obj);
                         assert(list->len);
-                        lam_value head = lam_eval(list->at(0), env);
-                        lam_callable* callable = head.as_callable();
-
-                        std::vector<lam_value> evaluatedArgs;
-                        std::span<lam_value> args{list->first() + 1, list->len - 1};
-
-                        // applicative arguments get evaluated, operative do not
-                        if (callable->type == lam_type::Applicative) {
-                            evaluatedArgs.resize(args.size());
-                            for (unsigned i = 0; i < args.size(); ++i) {
-                                evaluatedArgs[i] = lam_eval(args[i], env);
+                        // The environment, the head and the arguments live on the operand stack,
+                        // which keeps them rooted while the head and the arguments are evaluated.
+                        // Those evaluations may move the list, so its items are copied first.
+                        // Operatives get the unevaluated copies.
+                        size_t narg = list->len - 1;
+                        lam_value* window;
+                        bool inlined = false;  // lam_arith_inline was tried on the arguments
+                        if (list->len == 3 && is_atom(list->at(0)) && is_atom(list->at(1)) &&
+                            is_atom(list->at(2))) {
+                            // Atoms are evaluated without reaching a safe point, so they need no
+                            // roots yet, and arithmetic on ints and doubles, e.g. (- n 1), needs
+                            // neither the operand stack nor the builtin.
+                            lam_value head = eval_operand(list->at(0), env);
+                            lam_value x = list->at(1);
+                            lam_value y = list->at(2);
+                            if (head.as_callable()->type == lam_type::Applicative) {
+                                x = eval_operand(x, env);
+                                y = eval_operand(y, env);
+                                lam_value r;
+                                if (lam_arith_inline(head.as_callable()->arith, x, y, r)) {
+                                    return r;
+                                }
+                                inlined = true;
                             }
-                            args = {evaluatedArgs.data(), evaluatedArgs.size()};
+                            window = vm->operands.enter(4);
+                            window[0] = lam_make_value(env);
+                            window[1] = head;
+                            window[2] = x;
+                            window[3] = y;
+                        } else {
+                            window = vm->operands.enter(2 + narg);
+                            window[0] = lam_make_value(env);
+                            memcpy(window + 1, list->first(), list->len * sizeof(lam_value));
+                            lam_value head = eval_operand(window[1], env);
+                            window[1] = head;
+                            if (head.as_callable()->type == lam_type::Applicative) {
+                                for (size_t i = 0; i < narg; ++i) {
+                                    lam_value v = eval_operand(window[2 + i], window[0].as_env());
+                                    window[2 + i] = v;
+                                }
+                            }
+                        }
+                        env = window[0].as_env();
+                        lam_callable* callable = window[1].as_callable();
+                        lam_value* args = window + 2;
+
+                        // Arithmetic on ints and doubles does not need the builtin.
+                        lam_value r;
+                        if (!inlined && narg == 2 &&
+                            lam_arith_inline(callable->arith, args[0], args[1], r)) {
+                            vm->operands.leave(window);
+                            return r;
                         }
 
-                        lam_value_or_tail_call res =
-                            callable->invoke(callable, env, args.data(), args.size());
+                        if (owned && callable == static_cast<lam_env_impl*>(env)->_frame &&
+                            callable->code == nullptr && lam_can_rebind(env)) {
+                            lam_rebind_call_env(env, args, narg);
+                            vm->operands.leave(window);
+                            val = callable->body;
+                            break;
+                        }
+                        bool applicative = callable->type == lam_type::Applicative && callable->env;
+                        lam_value_or_tail_call res = lam_apply(callable, env, args, narg);
+                        env = window[0].as_env();
+                        vm->operands.leave(window);
                         if (res.env == nullptr) {
                             return res.value;
                         } else {  // tail call
+                            if (res.env != env) {
+                                owned = applicative;
+                            }
                             val = res.value;
                             env = res.env;
                         }
@@ -1179,52 +2072,32 @@ void lam_ugc_visit(ugc_t* gc, ugc_header_t* header) {
                 ugc_visit(gc, &o->header);
             }
         }
-    } else {
-        static_assert(offsetof(lam_obj, header) == 0);
-        lam_obj* obj = reinterpret_cast<lam_obj*>(header);
-        switch (obj->type) {
-            case lam_type::BigInt:
-            case lam_type::Symbol:
-            case lam_type::String:
-            case lam_type::Error:
-                break;
-            case lam_type::List: {
-                auto lst = static_cast<lam_list*>(obj);
-                for (lam_u64 i = 0; i < lst->len; ++i) {
-                    lam_value v = lst->at(i);
-                    if (auto o = v.obj_cast_value()) {
-                        ugc_visit(gc, &o->header);
-                    }
-                }
-                break;
+        vm->operands.for_each([gc](lam_value v) {
+            if (lam_obj* o = v.obj_cast_value()) {
+                ugc_visit(gc, &o->header);
             }
-            case lam_type::Operative:
-            case lam_type::Applicative: {
-                auto call = static_cast<lam_callable*>(obj);
-                if (auto e = call->env) {
-                    ugc_visit(gc, &e->header);
-                }
-                if (auto o = call->body.obj_cast_value()) {
-                    ugc_visit(gc, &o->header);
-                }
-                break;
+        });
+        for (auto&& f : vm->frames) {
+            ugc_visit(gc, &f.code->header);
+            if (!vm->frame_pool.contains(f.env)) {
+                ugc_visit(gc, &f.env->header);
             }
-            case lam_type::Environment: {
-                auto env = static_cast<lam_env_impl*>(obj);
-                if (env->_parent) {
-                    ugc_visit(gc, &env->_parent->header);
-                }
-                for (auto kv : env->_map) {
-                    if (auto o = kv.second.obj_cast_value()) {
-                        ugc_visit(gc, &o->header);
-                    }
+        }
+        vm->frame_pool.for_each(vm->frame_pool._base, [gc](lam_env_impl* frame) {
+            lam_for_each_ref(frame, [gc](auto& ref) {
+                if (lam_obj* o = lam_ref_obj(ref)) {
+                    ugc_visit(gc, &o->header);
                 }
-                break;
+            });
+        });
+    } else {
+        static_assert(offsetof(lam_obj, header) == 0);
+        lam_obj* obj = reinterpret_cast<lam_obj*>(header);
+        lam_for_each_ref(obj, [gc](auto& ref) {
+            if (lam_obj* o = lam_ref_obj(ref)) {
+                ugc_visit(gc, &o->header);
             }
-            default:
-                lam_debugbreak();
-                break;
-        }
+        });
     }
 }
 
@@ -1240,6 +2113,12 @@ void lam_ugc_free(ugc_t* gc, ugc_header_t* gobj) {
         case lam_type::BigInt:
             mpz_clear(static_cast<lam_bigint*>(obj)->mp);
             break;
+        case lam_type::Symbol:
+            vm->symbols.erase(static_cast<lam_symbol*>(obj));
+            break;
+    }
+    if (obj->located) {
+        vm->locations.old.erase(obj);
     }
     vm->hooks->mem_free(gobj);
 }
@@ -1,6 +1,7 @@
 #pragma once
 // Internal interfaces.
 
+#include <cmath>
 #include <cstdint>
 #include <string>
 #include <unordered_map>
@@ -27,6 +28,7 @@ enum class lam_type {
     Operative,    // 15
     Environment,  // 16
     Error,        // 17
+    Bytecode,     // 18
 };
 
 struct lam_env;
@@ -37,6 +39,7 @@ struct lam_symbol;
 struct lam_string;
 struct lam_callable;
 struct lam_bigint;
+struct lam_bytecode;
 struct lam_vm;
 struct lam_hooks;
 
@@ -47,7 +50,8 @@ namespace lam_Detail {
     X(lam_symbol, lam_type::Symbol)   \
     X(lam_list, lam_type::List)       \
     X(lam_env, lam_type::Environment) \
-    X(lam_error, lam_type::Error)
+    X(lam_error, lam_type::Error)     \
+    X(lam_bytecode, lam_type::Bytecode)
 
 template <typename T>
 struct TypeTrait;
@@ -83,8 +87,10 @@ enum lam_Magic : lam_u64 {
 /// Base class of all heap allocated objects.
 struct lam_obj {
     lam_obj(lam_type t) : type{t} {}
-    ugc_header_s header;
+    ugc_header_s header;  // unused while the object is in the nursery
     lam_type type;
+    bool remembered{false};  // in lam_nursery::remembered
+    bool located{false};     // has an entry in lam_locations
 };
 
 /// 'Boxed' NaN tagged value.
@@ -138,6 +144,8 @@ union lam_value {
 
     lam_env* as_env() const { return obj_cast_value<lam_env>(uval); }
 
+    lam_bytecode* as_bytecode() const { return obj_cast_value<lam_bytecode>(uval); }
+
     lam_callable* as_callable() const {
         assert((uval & lam_Magic::Mask) == lam_Magic::TagObj);
         lam_obj* obj = reinterpret_cast<lam_obj*>(uval & ~lam_Magic::Mask);
@@ -169,6 +177,9 @@ struct lam_value_or_tail_call {
     lam_value value;  // If env is null, 'value' is the result.
     lam_env* env;     // If env is not null the result is 'eval(value, env)'.
 };
+/// The arguments 'a' are rooted by the caller. A minor collection may run during any call back
+/// into the evaluator and move young objects, so an invoke which makes such calls keeps 'env'
+/// and whatever else it needs afterwards in a window of the operand stack.
 using lam_invoke = lam_value_or_tail_call(lam_callable* callable,
                                           lam_env* env,
                                           lam_value* a,
@@ -186,6 +197,11 @@ struct lam_list : lam_obj {
     }
 };
 
+/// The arithmetic builtins, which calls do inline when both arguments are ints or both are
+/// doubles, see lam_arith_inline. Bigints, mixed types and ints which overflow go through the
+/// builtin.
+enum class lam_arith : std::uint8_t { None, Add, Sub, Mul, Div, Mod, Lt, Le, Gt, Ge, Eq };
+
 /// Callable type. Either an applicative (evaluates arguments) or an operative (arguments are not
 /// implicilty evaluated)
 struct lam_callable : lam_obj {
@@ -194,25 +210,40 @@ struct lam_callable : lam_obj {
     lam_env* env;
     lam_value body;
     size_t num_args;       // not including variadic
-    const char* envsym;    // only for operatives, name to which we bind environment
-    const char* variadic;  // if not null, bind extra arguments to this name
+    lam_symbol* envsym;    // only for operatives, name to which we bind environment
+    lam_symbol* variadic;  // if not null, bind extra arguments to this name
     void* context;         // extra data
-    // char name[num_args]; // variable length
-    char** args() { return reinterpret_cast<char**>(this + 1); }
+    lam_bytecode* code;    // if not null, the compiled form of 'body'
+    lam_list* captures;    // names of the captured values, see lam_make_lambda
+    size_t num_captured;
+    bool keeps_env;        // a builtin applicative which may hold on to or pass on 'env'
+    lam_arith arith;       // which arithmetic builtin this is, if any
+    // lam_symbol* args[num_args]; lam_value captured[num_captured]; // variable length
+    lam_symbol** args() { return reinterpret_cast<lam_symbol**>(this + 1); }
+    lam_value* captured() { return reinterpret_cast<lam_value*>(args() + num_args); }
 };
 
-/// A symbol.
+/// A symbol. Symbols are interned per vm so two symbols are equal iff their addresses are.
+/// A dotted path such as "math.pi" is split into its segments when interned.
 struct lam_symbol : lam_obj {
     lam_u64 len;
+    lam_u64 hash;   // hash of the name, computed once when interned
+    lam_u64 nsegs;  // number of segments of a path, 0 if not one
     const char* val() const { return reinterpret_cast<const char*>(this + 1); }
-    // char name[len]; // variable length
+    lam_symbol** segs() {
+        size_t offset = (len + 1 + alignof(lam_symbol*) - 1) & ~(alignof(lam_symbol*) - 1);
+        return reinterpret_cast<lam_symbol**>(reinterpret_cast<char*>(this + 1) + offset);
+    }
+    // char name[len]; char zero{0}; // variable length
+    // lam_symbol* segs[nsegs]; // variable length, aligned
 };
 
 /// A UTF8 string.
 struct lam_string : lam_obj {
     lam_u64 len;
-    const char* val() const { return reinterpret_cast<const char*>(this + 1); }
-    // char name[len]; char zero{0}; // variable length
+    const char* data;  // follows the object, or points into source owned by the vm
+    const char* val() const { return data; }
+    // char name[len]; char zero{0}; // variable length, unless a view
 };
 
 /// Arbitrary precision integer.
@@ -227,24 +258,197 @@ struct lam_error : lam_obj {
     const char* msg;
 };
 
+/// Compiled form of a $define/$lambda body. See lam_compile.cpp for the instruction set.
+/// Instructions are 32 bit words, the low 8 bits are the opcode and the upper 24 bits the operand.
+struct lam_bytecode : lam_obj {
+    lam_u64 nconst;     // number of constants
+    lam_u64 ncode;      // number of instruction words
+    lam_u64 max_stack;  // operand stack slots needed by one activation
+    bool escapes;       // the call frame is expected to outlive a call, see lam_new_pooled_call_env
+    // lam_value consts[nconst]; std::uint32_t code[ncode]; // variable length
+    lam_value* consts() { return reinterpret_cast<lam_value*>(this + 1); }
+    const std::uint32_t* code() { return reinterpret_cast<std::uint32_t*>(consts() + nconst); }
+};
+
 /// Environments map symbols to values.
 struct lam_env : lam_obj {
     lam_vm* const vm;
     lam_env(lam_vm* v);
-    void bind_multiple(const char* keys[],
+    void bind_multiple(lam_symbol* const keys[],
                        size_t nkeys,
                        lam_value* values,
                        size_t nvalues,
-                       const char* variadic);
+                       lam_symbol* variadic);
 
     void seal();
+    void bind(lam_symbol* name, lam_value value);
     void bind(const char* name, lam_value value);
-    void bind_upsert(const char* name, lam_value value);
+    void bind_upsert(lam_symbol* name, lam_value value);
     void bind_applicative(const char* name, lam_invoke b);
     void bind_operative(const char* name, lam_invoke b, void* context = nullptr);
+    lam_value lookup(lam_symbol* sym) const;
     lam_value lookup(const char* sym) const;
 };
 
+/// Bindings of an environment, keyed by interned symbol.
+/// Open addressing in the style of SwissTable. Each slot has a control byte which is either
+/// Empty or the top 7 bits of the hash of its key. Probing loads a group of 8 control bytes
+/// as one word and tests them all at once. Bindings are never removed, so there are no
+/// tombstones. The storage (entries, then control bytes) is a single mem_alloc block.
+struct lam_env_table {
+    struct entry {
+        lam_symbol* key;
+        lam_value value;
+    };
+    static constexpr size_t GroupSize = 8;
+    static constexpr std::uint8_t Empty = 0x80;
+
+    lam_value* find(const lam_symbol* sym) const;
+    /// Return the value of 'sym', adding a null binding first if there is none.
+    lam_value* insert(lam_vm* vm, lam_symbol* sym, bool* inserted);
+    void release(lam_vm* vm);
+    bool empty() const { return _count == 0; }
+    template <typename F>
+    void for_each(F&& f) const {
+        for (size_t i = 0; i < _cap; ++i) {
+            if (_ctrl[i] != Empty) {
+                f(_entries[i]);
+            }
+        }
+    }
+
+    template <typename F>
+    void for_each(F&& f) {
+        for (size_t i = 0; i < _cap; ++i) {
+            if (_ctrl[i] != Empty) {
+                f(_entries[i]);
+            }
+        }
+    }
+
+   private:
+    void _grow(lam_vm* vm);
+    entry* _entries{};
+    std::uint8_t* _ctrl{};
+    size_t _cap{};  // zero or a power of two multiple of GroupSize
+    size_t _count{};
+};
+
+struct lam_env_impl : lam_env {
+    inline void* operator new(std::size_t, void* ptr) { return ptr; }
+
+    lam_env_impl(lam_vm* vm, lam_env* parent, const char* name)
+        : lam_env(vm), _parent{parent}, _name{name} {}
+    ~lam_env_impl() { _map.release(vm); }
+
+    // Look up the segments of 'sym' from 'first' on, starting in 'startEnv'. If 'cache', mark
+    // the environments searched as _cached.
+    static lam_value _lookup(lam_symbol* sym,
+                             const lam_env* startEnv,
+                             size_t first = 0,
+                             bool cache = false);
+    lam_symbol* _slot_name(size_t i) const;
+    lam_value* _find_slot(lam_symbol* sym) const;
+    lam_value* _find_captured(lam_symbol* sym) const;
+    lam_env_table _map;
+    lam_env* _parent{nullptr};
+    const char* _name{nullptr};
+    bool _sealed{false};
+    mutable bool _cached{false};  // an inline cache depends on it, see lam_vm::env_version
+    // Call frames of applicatives hold the arguments in slots rather than _map.
+    // The slot names are the parameters of _frame, followed by its variadic name.
+    // The values captured by _frame come after _map in lookups, as if they were bound in the
+    // frames which the closure was created in.
+    lam_callable* _frame{nullptr};
+    size_t _nslots{0};
+    bool _escaped{false};  // a reference to the environment may have been kept
+    // lam_value slots[_nslots]; // variable length
+    lam_value* slots() { return reinterpret_cast<lam_value*>(this + 1); }
+};
+
+static inline lam_obj* lam_ref_obj(lam_value v) {
+    return v.obj_cast_value();
+}
+static inline lam_obj* lam_ref_obj(lam_obj* o) {
+    return o;
+}
+
+/// Call f(ref) for each reference to another object held by 'obj'. 'ref' is either a lam_value&
+/// or a reference to a non-null pointer to a lam_obj derived type, so 'f' may update it.
+/// Use lam_ref_obj to get the object.
+template <typename F>
+void lam_for_each_ref(lam_obj* obj, F&& f) {
+    switch (obj->type) {
+        case lam_type::List: {
+            auto lst = static_cast<lam_list*>(obj);
+            for (lam_u64 i = 0; i < lst->len; ++i) {
+                f(lst->first()[i]);
+            }
+            break;
+        }
+        case lam_type::Operative:
+        case lam_type::Applicative: {
+            auto call = static_cast<lam_callable*>(obj);
+            if (call->env) {
+                f(call->env);
+            }
+            for (size_t i = 0; i < call->num_args; ++i) {
+                f(call->args()[i]);
+            }
+            if (call->variadic) {
+                f(call->variadic);
+            }
+            if (call->envsym) {
+                f(call->envsym);
+            }
+            f(call->body);
+            if (call->code) {
+                f(call->code);
+            }
+            if (call->captures) {
+                f(call->captures);
+            }
+            for (size_t i = 0; i < call->num_captured; ++i) {
+                f(call->captured()[i]);
+            }
+            break;
+        }
+        case lam_type::Bytecode: {
+            auto code = static_cast<lam_bytecode*>(obj);
+            for (lam_u64 i = 0; i < code->nconst; ++i) {
+                f(code->consts()[i]);
+            }
+            break;
+        }
+        case lam_type::Symbol: {
+            auto sym = static_cast<lam_symbol*>(obj);
+            for (lam_u64 i = 0; i < sym->nsegs; ++i) {
+                f(sym->segs()[i]);
+            }
+            break;
+        }
+        case lam_type::Environment: {
+            auto env = static_cast<lam_env_impl*>(obj);
+            if (env->_parent) {
+                f(env->_parent);
+            }
+            if (env->_frame) {
+                f(env->_frame);
+            }
+            for (size_t i = 0; i < env->_nslots; ++i) {
+                f(env->slots()[i]);
+            }
+            env->_map.for_each([&f](lam_env_table::entry& kv) {
+                f(kv.key);
+                f(kv.value);
+            });
+            break;
+        }
+        default:  // no references
+            break;
+    }
+}
+
 struct lam_stack : private std::vector<lam_value> {
     using vector::back;
     using vector::begin;
@@ -270,27 +474,463 @@ struct lam_stack : private std::vector<lam_value> {
     void pop(int n) { resize(size() - n); }
 };
 
+/// Operand stack of the bytecode interpreter, also holds the evaluated arguments of lam_eval.
+/// Each activation reserves a window of slots up front. Storage is chunked so that a window
+/// does not move while nested activations grow the stack. The stack is a GC root.
+struct lam_operand_stack {
+    lam_value* enter(size_t n);
+    void leave(lam_value* window);
+    template <typename F>
+    void for_each(F&& f) {
+        for (window& w : _windows) {
+            for (size_t i = 0; i < w.n; ++i) {
+                f(w.base[i]);
+            }
+        }
+    }
+    /// As for_each, but skip the windows which cannot have changed since the last call.
+    /// Only the topmost window is ever written, so these are the windows below the lowest
+    /// window which has been topmost since then.
+    template <typename F>
+    void for_each_dirty(F&& f) {
+        for (size_t i = _clean; i < _windows.size(); ++i) {
+            for (size_t j = 0; j < _windows[i].n; ++j) {
+                f(_windows[i].base[j]);
+            }
+        }
+        _clean = _windows.size();
+    }
+
+   private:
+    struct chunk {
+        std::vector<lam_value> mem;
+        size_t top{};
+    };
+    struct window {
+        lam_value* base;
+        size_t n;
+    };
+    std::vector<chunk> _chunks;
+    std::vector<window> _windows;
+    size_t _cur{};
+    size_t _clean{};
+};
+
+/// Intern table, maps each distinct name to its lam_symbol.
+/// Entries are weak: a symbol is removed from the table when it is collected.
+struct lam_symbol_table {
+    lam_symbol* find(const char* s, size_t len, lam_u64 hash) const;
+    void insert(lam_symbol* sym);
+    void erase(lam_symbol* sym);
+
+   private:
+    void _grow();
+    std::vector<lam_symbol*> _slots;  // open addressing, linear probing
+    size_t _count{};
+};
+
+/// Young generation. Objects are bump allocated here and promoted into the ugc managed old
+/// space if they are still reachable at a minor collection, see lam_gc.cpp.
+struct lam_nursery {
+    static constexpr size_t Size = 256 * 1024;
+    static constexpr size_t MaxObject = Size / 8;  // larger objects go to old space directly
+
+    bool contains(const void* p) const {
+        return std::uintptr_t(p) - std::uintptr_t(_base) < Size;
+    }
+    /// Zeroed memory, or null if it does not fit.
+    void* alloc(size_t size) {
+        size = (size + 7) & ~size_t(7);
+        if (size > size_t(_end - _top) || size > MaxObject) {
+            return nullptr;
+        }
+        void* p = _top;
+        _top += size;
+        return p;
+    }
+    /// Whether the next safe point should run a minor collection.
+    bool full() const { return _top > _limit; }
+
+    char* _base{};
+    char* _top{};
+    char* _limit{};
+    char* _end{};
+    std::vector<lam_obj*> finalize;    // young objects to finalize if they die
+    std::vector<lam_obj*> remembered;  // old objects which may refer to young ones
+    std::vector<lam_obj*> gray;        // promoted objects still to scan
+};
+
+/// LIFO storage for the call frames of compiled applicatives called from compiled code. A frame
+/// in the pool is released when its call returns rather than being left in the nursery. Frames
+/// in the pool are not registered with ugc, so the collectors scan them as roots, and no object
+/// may refer to one: a frame which would outlive its call is first moved to the heap by
+/// lam_escape_call_env.
+struct lam_frame_pool {
+    static constexpr size_t Size = 128 * 1024;
+
+    bool contains(const void* p) const {
+        return std::uintptr_t(p) - std::uintptr_t(_base) < Size;
+    }
+    /// Uninitialized memory, or null if it does not fit.
+    void* alloc(size_t size) {
+        if (size > size_t(_base + Size - _top)) {
+            return nullptr;
+        }
+        void* p = _top;
+        _top += size;
+        return p;
+    }
+    /// After the slots of 'frame' were changed.
+    void touch(lam_env_impl* frame) {
+        if (_clean > reinterpret_cast<char*>(frame)) {
+            _clean = reinterpret_cast<char*>(frame);
+        }
+    }
+    /// Release 'frame', which must be the last one allocated.
+    void release(lam_env_impl* frame) {
+        assert(frame->_map.empty());
+        assert(reinterpret_cast<char*>(frame->slots() + frame->_nslots) == _top);
+        _top = reinterpret_cast<char*>(frame);
+        if (_clean > _top) {
+            _clean = _top;
+        }
+    }
+    template <typename F>
+    void for_each(char* from, F&& f) {
+        for (char* p = from; p < _top;) {
+            auto frame = reinterpret_cast<lam_env_impl*>(p);
+            p += sizeof(lam_env_impl) + frame->_nslots * sizeof(lam_value);
+            f(frame);
+        }
+    }
+
+    char* _base{};
+    char* _top{};
+    char* _clean{};  // frames below this were scanned by the last minor collection
+};
+
+/// Activation of compiled code which is suspended while it calls another, see lam_execute.
+struct lam_frame {
+    lam_bytecode* code;
+    std::uint32_t pc;  // offset of the next instruction
+    lam_env* env;
+    lam_value* base;  // operand window
+    lam_value* sp;    // the callee is at sp[-1] and is replaced by the result
+};
+
+/// Where a list was parsed from.
+struct lam_location {
+    std::uint32_t file;  // index in lam_locations::files
+    std::uint32_t line;
+};
+
+/// Position of lam_parse in the module being imported, see lam_location_line.
+struct lam_parse_cursor {
+    const char* pos;
+    const char* end;
+    std::uint32_t line;  // of 'pos'
+    std::uint32_t file;
+};
+
+/// Source locations of lists, if enabled by lila_vm_set_source_locations. They are kept beside
+/// the lists rather than in them as only error reporting and profiling look at them. Entries are
+/// found by address: minor collections move the ones of young lists which survive to 'old', and
+/// freeing a list removes its entry.
+struct lam_locations {
+    bool enabled{};
+    std::vector<std::string> files;
+    std::unordered_map<const lam_obj*, lam_location> old;
+    std::vector<std::pair<lam_obj*, lam_location>> young;
+    lam_parse_cursor cursor{};  // records lists while 'pos' is set
+};
+
+/// An open list in lam_parse.
+struct lam_parse_list {
+    size_t first;        // index of its first item in lam_vm::parse_items
+    std::uint32_t line;  // where it starts, if recording locations
+};
+
+/// Module source which strings may refer to.
+struct lam_source {
+    const char* data;
+    size_t len;
+};
+
 struct lam_vm {
     ugc_t gc{};
     lam_stack stack;
+    lam_operand_stack operands;
+    std::vector<lam_frame> frames;
+    size_t frames_clean{};  // frames below this were suspended before the last minor collection
+    lam_nursery nursery;
+    lam_frame_pool frame_pool;
+    lam_symbol_table symbols;
     lam_hooks* hooks{};
     lam_env* root{};
     std::unordered_map<std::string, lam_value> imports{};
+    std::vector<lam_source> sources;  // owned until the vm is deleted, see lila_vm_import_owned
+    // Scratch space of lam_parse, reused between calls: the items of the lists which are still
+    // open and the lists. Parsing has no safe points, so the items are not roots.
+    std::vector<lam_value> parse_items;
+    std::vector<lam_parse_list> parse_lists;
+    lam_locations locations;
+    bool compile{true};  // compile $define/$lambda bodies to bytecode
+    lam_u64 env_version{1};  // changed by bindings in _cached environments, to invalidate caches
+    unsigned parse_threads{1};  // see lila_vm_set_parse_threads
+    // Builtin operatives which the compiler expands inline.
+    struct {
+        lam_callable* if_{};
+        lam_callable* begin{};
+        lam_callable* quote{};
+        lam_callable* lambda{};
+    } forms;
     struct {
         lam_u64 alloc_count{};
         lam_u64 free_count{};
         lam_u64 gc_iter_count{};
+        lam_u64 minor_count{};
+        lam_u64 major_count{};
+        lam_u64 promoted_count{};
+        lam_u64 old_count{};  // objects registered with ugc
+        lam_u64 pause_max_ns{};
+        lam_u64 pause_hist[16]{};  // see lila_gc_stats
     } gc_stats;
+    // Scheduling of the incremental major collection, see lam_gc_safe_point.
+    struct {
+        lam_u64 trigger{};           // alloc_count at which to do more work
+        lam_u64 budget_ns{500'000};  // per safe point
+        bool cycle{};                // a major collection is in progress
+    } gc_pace;
 };
 
+/// Whether all of 's' to 'end' is in source owned by the vm, which strings may refer to.
+static inline bool lam_owns_source(lam_vm* vm, const char* s, const char* end) {
+    for (auto& src : vm->sources) {
+        if (std::uintptr_t(s) - std::uintptr_t(src.data) < src.len) {
+            return std::uintptr_t(end) - std::uintptr_t(src.data) <= src.len;
+        }
+    }
+    return false;
+}
+
+/// Allocate the nursery.
+void lam_gc_init(lam_vm* vm);
+/// Release the nursery, it must be empty.
+void lam_gc_quit(lam_vm* vm);
+/// Zeroed memory registered with ugc. If 'remember' the object may be initialized with
+/// references to young objects, so it is added to the remembered set.
+void* lam_alloc_old(lam_vm* vm, size_t size, bool remember);
+/// Promote the reachable young objects and empty the nursery.
+void lam_collect_minor(lam_vm* vm);
+/// Minor collection followed by a full ugc collection.
+void lam_collect_major(lam_vm* vm);
+/// Minor collection and, if one is due, a bounded slice of the incremental major collection.
+void lam_gc_safe_point(lam_vm* vm);
+
+/// Called where the caller holds no raw pointers to heap objects other than in vm roots. If
+/// true, the caller roots what it holds and calls lam_gc_safe_point.
+static inline bool lam_at_safe_point(lam_vm* vm) {
+    return vm->nursery.full() || vm->gc_stats.alloc_count >= vm->gc_pace.trigger;
+}
+
+/// Record the store of 'child' into 'parent'. Needed wherever an object which may be old is
+/// modified after it was created.
+static inline void lam_write_barrier(lam_vm* vm, lam_obj* parent, lam_value child) {
+    lam_obj* c = child.obj_cast_value();
+    if (c == nullptr || vm->nursery.contains(parent)) {
+        return;
+    }
+    if (vm->nursery.contains(c)) {
+        if (!parent->remembered) {
+            parent->remembered = true;
+            vm->nursery.remembered.push_back(parent);
+        }
+    } else if (vm->gc_pace.cycle) {
+        ugc_write_barrier(&vm->gc, UGC_BARRIER_BACKWARD, &parent->header, &c->header);
+    }
+}
+
+/// Objects which own memory outside the heap must be finalized if they die while young.
+static inline void lam_track_finalizer(lam_vm* vm, lam_obj* obj) {
+    if (vm->nursery.contains(obj)) {
+        vm->nursery.finalize.push_back(obj);
+    }
+}
+
 // Create values
 
 static inline lam_value lam_make_double(double d) {
     return {.dval = d};
 }
 static inline lam_value lam_make_int(int i) {
-    return {.uval = lam_u32(i) | lam_Magic::TagInt};
+    return {.uval = std::uint32_t(i) | lam_Magic::TagInt};
+}
+
+/// Compare 'a' and 'b' with the comparison 'Op'.
+template <lam_arith Op, typename T>
+static inline bool lam_compare(T a, T b) {
+    static_assert(Op >= lam_arith::Lt);
+    if constexpr (Op == lam_arith::Lt) {
+        return a < b;
+    } else if constexpr (Op == lam_arith::Le) {
+        return a <= b;
+    } else if constexpr (Op == lam_arith::Gt) {
+        return a > b;
+    } else if constexpr (Op == lam_arith::Ge) {
+        return a >= b;
+    } else {
+        return a == b;
+    }
 }
+
+/// Set 'out' to 'a Op b' unless the result needs a bigint, or is an error. Returns whether it
+/// did. Quotients are doubles and 'mod' takes the sign of the divisor. A 'mod' by zero is an
+/// error for ints and doubles alike, while '/' by zero gives an infinity or NaN.
+template <lam_arith Op>
+static inline bool lam_arith_ints(int a, int b, lam_value& out) {
+    std::int64_t x = a;  // wide enough for any sum, difference or product
+    std::int64_t y = b;
+    std::int64_t r;
+    if constexpr (Op == lam_arith::Add) {
+        r = x + y;
+    } else if constexpr (Op == lam_arith::Sub) {
+        r = x - y;
+    } else if constexpr (Op == lam_arith::Mul) {
+        r = x * y;
+    } else if constexpr (Op == lam_arith::Div) {
+        out = lam_make_double(double(a) / double(b));
+        return true;
+    } else if constexpr (Op == lam_arith::Mod) {
+        if (b == 0) {
+            return false;
+        }
+        r = x % y;
+        r += (r != 0 && (r < 0) != (y < 0)) ? y : 0;
+    } else {
+        out = lam_make_int(lam_compare<Op>(a, b));
+        return true;
+    }
+    if (r != int(r)) {
+        return false;
+    }
+    out = lam_make_int(int(r));
+    return true;
+}
+
+/// 'a Op b' on doubles. The divisor of a 'mod' is not zero.
+template <lam_arith Op>
+static inline lam_value lam_arith_doubles(double a, double b) {
+    if constexpr (Op == lam_arith::Add) {
+        return lam_make_double(a + b);
+    } else if constexpr (Op == lam_arith::Sub) {
+        return lam_make_double(a - b);
+    } else if constexpr (Op == lam_arith::Mul) {
+        return lam_make_double(a * b);
+    } else if constexpr (Op == lam_arith::Div) {
+        return lam_make_double(a / b);
+    } else if constexpr (Op == lam_arith::Mod) {
+        double r = std::fmod(a, b);
+        return lam_make_double((r != 0 && (r < 0) != (b < 0)) ? r + b : r);
+    } else {
+        return lam_make_int(lam_compare<Op>(a, b));
+    }
+}
+
+/// Set 'out' to 'x Op y' if both are ints or both are doubles, and the result needs neither a
+/// bigint nor an error. Returns false otherwise.
+template <lam_arith Op>
+static inline bool lam_arith_inline(lam_value x, lam_value y, lam_value& out) {
+    if ((x.uval & lam_Magic::Mask) == lam_Magic::TagInt &&
+        (y.uval & lam_Magic::Mask) == lam_Magic::TagInt) {
+        return lam_arith_ints<Op>(x.as_int(), y.as_int(), out);
+    }
+    if ((x.uval & lam_Magic::TaggedNan) != lam_Magic::TaggedNan &&
+        (y.uval & lam_Magic::TaggedNan) != lam_Magic::TaggedNan) {
+        if (Op == lam_arith::Mod && y.dval == 0) {
+            return false;
+        }
+        out = lam_arith_doubles<Op>(x.dval, y.dval);
+        return true;
+    }
+    return false;
+}
+
+/// As above, for the arithmetic builtin 'op' known only at runtime.
+static inline bool lam_arith_inline(lam_arith op, lam_value x, lam_value y, lam_value& out) {
+    if (op == lam_arith::None) {
+        return false;
+    }
+    if ((x.uval & lam_Magic::Mask) == lam_Magic::TagInt &&
+        (y.uval & lam_Magic::Mask) == lam_Magic::TagInt) {
+        int a = x.as_int();
+        int b = y.as_int();
+        switch (op) {
+            case lam_arith::Add:
+                return lam_arith_ints<lam_arith::Add>(a, b, out);
+            case lam_arith::Sub:
+                return lam_arith_ints<lam_arith::Sub>(a, b, out);
+            case lam_arith::Mul:
+                return lam_arith_ints<lam_arith::Mul>(a, b, out);
+            case lam_arith::Div:
+                return lam_arith_ints<lam_arith::Div>(a, b, out);
+            case lam_arith::Mod:
+                return lam_arith_ints<lam_arith::Mod>(a, b, out);
+            case lam_arith::Lt:
+                return lam_arith_ints<lam_arith::Lt>(a, b, out);
+            case lam_arith::Le:
+                return lam_arith_ints<lam_arith::Le>(a, b, out);
+            case lam_arith::Gt:
+                return lam_arith_ints<lam_arith::Gt>(a, b, out);
+            case lam_arith::Ge:
+                return lam_arith_ints<lam_arith::Ge>(a, b, out);
+            default:
+                return lam_arith_ints<lam_arith::Eq>(a, b, out);
+        }
+    }
+    if ((x.uval & lam_Magic::TaggedNan) != lam_Magic::TaggedNan &&
+        (y.uval & lam_Magic::TaggedNan) != lam_Magic::TaggedNan) {
+        double a = x.dval;
+        double b = y.dval;
+        switch (op) {
+            case lam_arith::Add:
+                out = lam_arith_doubles<lam_arith::Add>(a, b);
+                break;
+            case lam_arith::Sub:
+                out = lam_arith_doubles<lam_arith::Sub>(a, b);
+                break;
+            case lam_arith::Mul:
+                out = lam_arith_doubles<lam_arith::Mul>(a, b);
+                break;
+            case lam_arith::Div:
+                out = lam_arith_doubles<lam_arith::Div>(a, b);
+                break;
+            case lam_arith::Mod:
+                if (b == 0) {
+                    return false;
+                }
+                out = lam_arith_doubles<lam_arith::Mod>(a, b);
+                break;
+            case lam_arith::Lt:
+                out = lam_arith_doubles<lam_arith::Lt>(a, b);
+                break;
+            case lam_arith::Le:
+                out = lam_arith_doubles<lam_arith::Le>(a, b);
+                break;
+            case lam_arith::Gt:
+                out = lam_arith_doubles<lam_arith::Gt>(a, b);
+                break;
+            case lam_arith::Ge:
+                out = lam_arith_doubles<lam_arith::Ge>(a, b);
+                break;
+            default:
+                out = lam_arith_doubles<lam_arith::Eq>(a, b);
+                break;
+        }
+        return true;
+    }
+    return false;
+}
+
 static inline lam_value lam_make_opaque(unsigned long long u) {
     assert(u <= 0x0000ffff'ffffffff);
     return {.uval = u | lam_Magic::TagOpaque};
@@ -301,8 +941,13 @@ static inline lam_value lam_make_opaque(const void* p) {
 static inline lam_value lam_make_null() {
     return {.uval = lam_Magic::ValueConstNull};
 }
+/// Return the interned symbol for the given name, creating it if needed.
 lam_value lam_make_symbol(lam_vm* vm, const char* s, size_t n = size_t(-1));
+/// Return the interned symbol for the given name, or null if there is none.
+lam_symbol* lam_find_symbol(lam_vm* vm, const char* s, size_t n = size_t(-1));
 lam_value lam_make_string(lam_vm* vm, const char* s, size_t n = size_t(-1));
+/// A string which refers to 's' in source owned by the vm, not null terminated.
+lam_value lam_make_string_view(lam_vm* vm, const char* s, size_t n);
 lam_value lam_make_bigint(lam_vm* vm, int i);
 lam_value lam_make_error(lam_vm* vm, unsigned code, const char* msg);
 
@@ -316,6 +961,31 @@ lam_value lam_make_list_v(lam_vm* vm, const lam_value* values, size_t N);
 
 lam_value lam_make_env(lam_vm* vm, lam_env* parent, const char* name);
 
+lam_bytecode* lam_new_bytecode(lam_vm* vm,
+                               const lam_value* consts,
+                               size_t nconst,
+                               const std::uint32_t* code,
+                               size_t ncode,
+                               size_t max_stack);
+
+enum ErrorCode {
+    OK = 0,
+    GenericFailure,
+    ParseEndOfInput,
+    ParseUnexpectedNull,
+    ParseUnexpectedSemiColon,
+    ParseUnexpectedEscape,
+    ParseUnexpectedEndOfFile,
+    ParseUnexpectedEndList,
+    ParseMissingSymbolName,
+    ImportNotFound,
+    SymbolNotFound,
+    WrongNumberOfArguments,
+    NonNumericArguments,
+    LlcInvalid,
+    DivisionByZero,
+};
+
 // If code==0, 'value' is valid, otherwise 'msg'. TODO union?
 struct lam_result {
     static lam_result ok(lam_value v) { return {0, v, nullptr}; }
@@ -340,10 +1010,133 @@ void lam_print(lam_vm* vm, lam_value val, const char* end = nullptr);
 
 lam_result lam_parse(lam_vm* vm, const char* input, const char* endInput, const char** restart);
 
+/// State of a parse which may span several chunks of input, see lam_parser_feed.
+/// Only the text of the current statement is kept, so that no values are held between chunks.
+struct lam_parser {
+    enum State : unsigned char { Between, Word, String, Escape, Semi, Comment };
+    std::string text;  // the current statement, from previous chunks
+    State state{Between};
+    bool started{};    // in a statement
+    bool dotted{};     // the statement ends with "(... .)" and extends to the end of input
+    bool dot{};        // the word just read was "."
+    size_t depth{};    // of lists
+    size_t word_len{};
+};
+
+/// Find the end of the next statement in a chunk of input without parsing it. On success, the
+/// part of the statement in this chunk is [start, stop). Fails with ParseEndOfInput when the
+/// chunk ends before the statement does, or with another parse error.
+lam_result lam_parser_scan(lam_parser* p,
+                           const char* input,
+                           const char* end,
+                           const char** start,
+                           const char** stop);
+/// Parse the next statement from a chunk of input, setting 'restart' past the input consumed.
+/// Fails with ParseEndOfInput when the chunk ends before the statement does.
+lam_result lam_parser_feed(lam_vm* vm,
+                           lam_parser* p,
+                           const char* input,
+                           const char* end,
+                           const char** restart);
+/// Parse the statement which is left at the end of input.
+/// Fails with ParseEndOfInput if there is none.
+lam_result lam_parser_finish(lam_vm* vm, lam_parser* p);
+
+/// The line of 'pos' in the module being imported, or 0 if locations are not being recorded.
+std::uint32_t lam_location_line(lam_vm* vm, const char* pos);
+/// Record that 'obj' was parsed from 'line' of the module being imported.
+void lam_set_location(lam_vm* vm, lam_obj* obj, std::uint32_t line);
+/// Find where 'obj' was parsed from. Slow, for error reporting and profiling.
+bool lam_find_location(lam_vm* vm, const lam_obj* obj, const char** file, unsigned* line);
+
+// Precompiled modules, see lam_llc.cpp.
+
+/// Hash of module source, recorded in the .llc made from it.
+lam_u64 lam_llc_hash(const char* src, size_t len);
+/// Parse all of 'src' and write it to 'out' in the .llc format.
+lam_result lam_llc_save(lam_vm* vm, const char* src, size_t len, std::vector<char>& out);
+/// The source hash in the header of a .llc, false if 'data' is not one.
+bool lam_llc_source_hash(const void* data, size_t len, lam_u64* hash);
+/// Evaluate the statements of a .llc in the environment on top of the stack.
+lam_result lam_llc_eval(lam_vm* vm, const void* data, size_t len);
+
 lam_env* lam_new_env(lam_vm* vm, lam_env* parent, const char* name);
 
+/// Compile time view of the call frame of a body.
+/// Mirrors the slot layout of lam_new_call_env and the values captured by the callable.
+struct lam_scope {
+    lam_symbol* const* names;  // parameters
+    size_t count;
+    lam_symbol* variadic;  // if not null, in the slot after the parameters
+    lam_symbol* const* captures{nullptr};
+    size_t ncaptures{0};
+};
+
 lam_value lam_eval(lam_value val, lam_env* env);
 
+/// Invoke 'call'. The result may be a tail call.
+lam_value_or_tail_call lam_apply(lam_callable* call, lam_env* env, lam_value* args, size_t narg);
+
+/// Call 'call' with already evaluated (or for operatives, unevaluated) arguments.
+lam_value lam_eval_call(lam_callable* call, lam_env* env, lam_value* args, size_t narg);
+
+/// Create the environment for a call to the applicative 'call' and bind the arguments.
+lam_env* lam_new_call_env(lam_callable* call, lam_value* args, size_t narg);
+
+/// As lam_new_call_env, in the frame pool if the compiled body of 'call' is not expected to let
+/// the frame escape and there is room. The caller releases it with lam_release_call_env.
+lam_env* lam_new_pooled_call_env(lam_callable* call, lam_value* args, size_t narg);
+
+/// Release 'env' if it is the frame on top of the pool.
+inline void lam_release_call_env(lam_env* env) {
+    lam_frame_pool& pool = env->vm->frame_pool;
+    if (pool.contains(env)) {
+        pool.release(static_cast<lam_env_impl*>(env));
+    }
+}
+
+/// Note that a reference to 'env' is kept, e.g. by a closure or as a value.
+inline void lam_env_escapes(lam_env* env) {
+    static_cast<lam_env_impl*>(env)->_escaped = true;
+}
+
+/// A self tail call may bind its arguments in the frame of the current call rather than a new
+/// one, if nothing else can see the frame.
+inline bool lam_can_rebind(lam_env* env) {
+    auto frame = static_cast<lam_env_impl*>(env);
+    return !frame->_escaped && frame->_map.empty();
+}
+
+/// Replace the arguments in the call frame 'env', see lam_can_rebind.
+void lam_rebind_call_env(lam_env* env, lam_value* args, size_t narg);
+
+/// Move 'env' out of the pool before a reference to it is stored or handed to code which might,
+/// e.g. eval, getenv or an operative. Returns the environment to use from then on.
+lam_env* lam_escape_call_env(lam_env* env);
+
+/// Truthiness as used by $if.
+bool lam_truthy(lam_value v);
+
+/// Create an applicative from the parameter form 'params' (list or variadic symbol) and body.
+/// If 'code' is null and compilation is enabled, the body is compiled.
+/// A closure made by compiled code copies the values of the symbols 'captures' which its body
+/// refers to in the enclosing frames, from 'values'.
+lam_value lam_make_lambda(lam_env* env,
+                          lam_value params,
+                          lam_value body,
+                          lam_bytecode* code,
+                          lam_list* captures = nullptr,
+                          const lam_value* values = nullptr);
+
+/// Compile 'body' to bytecode. The result is shared by all closures created from the same body.
+/// References to parameters in 'scope' are resolved to frame slots, other symbols are looked up
+/// by name at runtime.
+lam_bytecode* lam_compile(lam_vm* vm, lam_value body, const lam_scope* scope);
+
+/// Run compiled code in 'env'. Like lam_invoke, the result may be a tail call.
+/// Entering it and calls between compiled applicatives are safe points.
+lam_value_or_tail_call lam_execute(lam_bytecode* code, lam_env* env);
+
 void lam_ugc_visit(ugc_t* gc, ugc_header_t* header);
 
 void lam_ugc_free(ugc_t* gc, ugc_header_t* gobj);
@@ -0,0 +1,282 @@
+#include "lam_core.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+// Young generation.
+//
+// Most objects die soon after they are created, e.g. the environment of a call is garbage once
+// the call returns. New objects are bump allocated in a fixed size nursery instead of going
+// through mem_alloc and ugc_register one at a time. A minor collection copies the young objects
+// which are still reachable into the ugc managed old space and then reuses the whole nursery.
+//
+// Copying moves objects, so a minor collection may only run where every live reference is
+// somewhere the collector can update: in the vm roots, the operand stack, the frame stack, the
+// frame pool or in another object. Those places are the safe points, see lam_at_safe_point.
+// Any call into the evaluator may reach one, so code which needs a value after such a call keeps
+// it in a window of the operand stack and reads it back from there.
+//
+// Old objects which are modified to refer to young ones are recorded by lam_write_barrier in
+// the remembered set, which is the other source of roots. If the nursery fills up between safe
+// points, objects are allocated in old space and remembered.
+//
+// Old generation.
+//
+// Old space is collected by ugc, incrementally. Once enough has been allocated since the last
+// cycle, each safe point runs ugc steps for up to gc_pace.budget_ns after its minor collection,
+// and at least MinSteps of them.
+// The nursery is always empty while ugc runs, so it only ever sees old objects. Between steps
+// the program keeps running and ugc must be told about new references from old objects which
+// it may already have scanned:
+// * lam_write_barrier for stores into old objects.
+// * Promoted and remembered objects have their references visited.
+// * Symbols found by interning were possibly unreachable, so they are marked.
+
+// A cycle starts once this many objects have been allocated since the previous one ended, or
+// twice the number of live old objects if that is more.
+static constexpr lam_u64 MinCycleAllocs = 64 * 1024;
+// While a cycle is in progress, do some more work every this many allocations.
+static constexpr lam_u64 StepAllocs = 1024;
+// ugc steps between checks of the clock.
+static constexpr int StepBatch = 64;
+// Steps which are done even if they exceed the pause budget. A step marks or frees at most one
+// object, so this bounds how much the heap grows before a cycle ends however slow the steps are.
+static constexpr lam_u64 MinSteps = 2 * StepAllocs;
+
+void lam_gc_init(lam_vm* vm) {
+    lam_nursery& n = vm->nursery;
+    n._base = static_cast<char*>(vm->hooks->mem_alloc(lam_nursery::Size));
+    memset(n._base, 0, lam_nursery::Size);
+    n._top = n._base;
+    n._limit = n._base + lam_nursery::Size * 3 / 4;
+    n._end = n._base + lam_nursery::Size;
+    vm->gc_pace.trigger = MinCycleAllocs;
+    lam_frame_pool& pool = vm->frame_pool;
+    pool._base = static_cast<char*>(vm->hooks->mem_alloc(lam_frame_pool::Size));
+    pool._top = pool._clean = pool._base;
+}
+
+void lam_gc_quit(lam_vm* vm) {
+    lam_nursery& n = vm->nursery;
+    assert(n._top == n._base);
+    vm->hooks->mem_free(n._base);
+    n = {};
+    lam_frame_pool& pool = vm->frame_pool;
+    assert(pool._top == pool._base);
+    vm->hooks->mem_free(pool._base);
+    pool = {};
+}
+
+void* lam_alloc_old(lam_vm* vm, size_t size, bool remember) {
+    void* p = vm->hooks->mem_alloc(size);
+    memset(p, 0, size);
+    auto o = reinterpret_cast<lam_obj*>(p);
+    ugc_register(&vm->gc, &o->header);
+    vm->gc_stats.old_count += 1;
+    if (remember) {
+        o->remembered = true;
+        vm->nursery.remembered.push_back(o);
+    }
+    return p;
+}
+
+static size_t object_size(lam_obj* obj) {
+    switch (obj->type) {
+        case lam_type::BigInt:
+            return sizeof(lam_bigint);
+        case lam_type::Error:
+            return sizeof(lam_error);
+        case lam_type::List:
+            return sizeof(lam_list) + static_cast<lam_list*>(obj)->cap * sizeof(lam_value);
+        case lam_type::Applicative:
+        case lam_type::Operative: {
+            auto call = static_cast<lam_callable*>(obj);
+            return sizeof(lam_callable) + call->num_args * sizeof(lam_symbol*) +
+                   call->num_captured * sizeof(lam_value);
+        }
+        case lam_type::Environment:
+            return sizeof(lam_env_impl) +
+                   static_cast<lam_env_impl*>(obj)->_nslots * sizeof(lam_value);
+        case lam_type::Bytecode: {
+            auto code = static_cast<lam_bytecode*>(obj);
+            return sizeof(lam_bytecode) + code->nconst * sizeof(lam_value) +
+                   code->ncode * sizeof(std::uint32_t);
+        }
+        default:  // symbols and strings are never young
+            assert(false);
+            return 0;
+    }
+}
+
+// A young object which has been copied holds the address of its copy in place of the ugc
+// header, which is otherwise unused (zero) in the nursery.
+static lam_obj* forwarded(lam_obj* obj) {
+    lam_obj* to;
+    memcpy(&to, &obj->header, sizeof(to));
+    return to;
+}
+
+namespace {
+
+struct Promoter {
+    lam_vm* vm;
+
+    lam_obj* promote(lam_obj* obj) {
+        if (lam_obj* to = forwarded(obj)) {
+            return to;
+        }
+        size_t size = object_size(obj);
+        auto to = static_cast<lam_obj*>(vm->hooks->mem_alloc(size));
+        memcpy(static_cast<void*>(to), obj, size);
+        memset(&to->header, 0, sizeof(to->header));
+        ugc_register(&vm->gc, &to->header);
+        memcpy(&obj->header, &to, sizeof(to));
+        vm->nursery.gray.push_back(to);
+        vm->gc_stats.old_count += 1;
+        vm->gc_stats.promoted_count += 1;
+        return to;
+    }
+
+    void operator()(lam_value& v) {
+        lam_obj* o = v.obj_cast_value();
+        if (o && vm->nursery.contains(o)) {
+            v = lam_make_value(promote(o));
+        }
+    }
+
+    template <typename T>
+    void operator()(T*& p) {
+        if (p && vm->nursery.contains(p)) {
+            p = static_cast<T*>(promote(p));
+        }
+    }
+};
+
+}  // namespace
+
+void lam_collect_minor(lam_vm* vm) {
+    lam_nursery& n = vm->nursery;
+    Promoter fwd{vm};
+
+    for (lam_value& v : vm->stack) {
+        fwd(v);
+    }
+    // Suspended activations are left alone until they resume, so the ones which were already
+    // scanned by the previous minor collection only refer to old objects.
+    vm->operands.for_each_dirty([&fwd](lam_value& v) { fwd(v); });
+    for (size_t i = vm->frames_clean; i < vm->frames.size(); ++i) {
+        fwd(vm->frames[i].code);
+        fwd(vm->frames[i].env);
+    }
+    vm->frames_clean = vm->frames.size();
+    lam_frame_pool& pool = vm->frame_pool;
+    pool.for_each(pool._clean, [&fwd](lam_env_impl* frame) { lam_for_each_ref(frame, fwd); });
+    pool._clean = pool._top;
+    fwd(vm->root);
+    for (auto& m : vm->imports) {
+        fwd(m.second);
+    }
+    fwd(vm->forms.if_);
+    fwd(vm->forms.begin);
+    fwd(vm->forms.quote);
+    fwd(vm->forms.lambda);
+    // During a major collection, objects which ugc may have scanned already (remembered) or
+    // which it treats as reachable (promoted) could refer to old objects which it has not marked.
+    bool cycle = vm->gc_pace.cycle;
+    for (lam_obj* o : n.remembered) {
+        o->remembered = false;
+        lam_for_each_ref(o, fwd);
+        if (cycle) {
+            lam_ugc_visit(&vm->gc, &o->header);
+        }
+    }
+    n.remembered.clear();
+
+    // Promoted objects may refer to more young objects.
+    while (!n.gray.empty()) {
+        lam_obj* o = n.gray.back();
+        n.gray.pop_back();
+        lam_for_each_ref(o, fwd);
+        if (cycle) {
+            lam_ugc_visit(&vm->gc, &o->header);
+        }
+    }
+
+    // Source locations of lists which survived move with them.
+    lam_locations& locs = vm->locations;
+    for (auto& [o, loc] : locs.young) {
+        if (lam_obj* to = forwarded(o)) {
+            locs.old[to] = loc;
+        }
+    }
+    locs.young.clear();
+
+    for (lam_obj* o : n.finalize) {
+        if (forwarded(o)) {
+            continue;
+        }
+        if (o->type == lam_type::Environment) {
+            static_cast<lam_env_impl*>(o)->~lam_env_impl();
+        } else if (o->type == lam_type::BigInt) {
+            mpz_clear(static_cast<lam_bigint*>(o)->mp);
+        }
+    }
+    n.finalize.clear();
+
+    memset(n._base, 0, n._top - n._base);
+    n._top = n._base;
+    vm->gc_stats.minor_count += 1;
+}
+
+// ugc is idle between cycles.
+static bool ugc_idle(ugc_t* gc) {
+    return gc->state == 0;
+}
+
+static void end_cycle(lam_vm* vm) {
+    lam_u64 live = vm->gc_stats.old_count - vm->gc_stats.free_count;
+    vm->gc_pace.cycle = false;
+    vm->gc_pace.trigger = vm->gc_stats.alloc_count + std::max(MinCycleAllocs, 2 * live);
+    vm->gc_stats.major_count += 1;
+}
+
+void lam_collect_major(lam_vm* vm) {
+    lam_collect_minor(vm);
+    ugc_collect(&vm->gc);
+    end_cycle(vm);
+}
+
+void lam_gc_safe_point(lam_vm* vm) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    auto elapsed = [start]() -> lam_u64 {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    };
+    lam_collect_minor(vm);
+
+    auto& pace = vm->gc_pace;
+    if (pace.cycle || vm->gc_stats.alloc_count >= pace.trigger) {
+        pace.cycle = true;
+        lam_u64 steps = 0;
+        do {
+            for (int i = 0; i < StepBatch && pace.cycle; ++i) {
+                ugc_step(&vm->gc);
+                pace.cycle = !ugc_idle(&vm->gc);
+            }
+            steps += StepBatch;
+        } while (pace.cycle && (steps < MinSteps || elapsed() < pace.budget_ns));
+        if (pace.cycle) {
+            pace.trigger = vm->gc_stats.alloc_count + StepAllocs;
+        } else {
+            end_cycle(vm);
+        }
+    }
+
+    lam_u64 ns = elapsed();
+    auto& stats = vm->gc_stats;
+    stats.pause_max_ns = std::max(stats.pause_max_ns, ns);
+    size_t bucket = std::bit_width(ns / 1000);  // 0 below 1us, then powers of two
+    stats.pause_hist[std::min(bucket, std::size(stats.pause_hist) - 1)] += 1;
+}
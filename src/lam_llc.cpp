@@ -0,0 +1,322 @@
+#include "lam_core.h"
+
+#include <bit>
+#include <cstring>
+#include <unordered_map>
+
+// Precompiled modules (.llc).
+//
+// A .llc holds the statements of a module as parsed by lam_parse, so that importing it does not
+// tokenize, parse numbers or unescape strings. It contains only offsets, never pointers, so it
+// can be used in place from a read only memory mapping. All fields are little endian.
+//
+//   header    magic, version, hash of the source text, section sizes
+//   symbols   nsym x (offset, len) into text
+//   strings   nstr x (offset, len) into text
+//   lists     nlist x (first cell, len)
+//   stmts     nstmt x (cell, lists_end)
+//   cells     ncell x u64
+//   text      ntext bytes
+//
+// A cell is the bits of an immediate lam_value (int, double or null), or TagObj with the kind
+// of object in the upper 16 bits of the payload and its index in the corresponding section in
+// the lower 32. Lists are stored children first and each statement only uses the lists since
+// the previous statement, up to its 'lists_end', so a statement can be rebuilt on its own.
+
+namespace {
+
+constexpr char Magic[4] = {'l', 'l', 'c', 0};
+constexpr std::uint32_t Version = 1;
+
+enum Kind : lam_u64 {
+    KindSymbol = 1,
+    KindString = 2,
+    KindList = 3,
+};
+
+constexpr lam_u64 encode(Kind kind, std::uint32_t index) {
+    return lam_Magic::TagObj | (kind << 32) | index;
+}
+
+struct Header {
+    char magic[4];
+    std::uint32_t version;
+    lam_u64 source_hash;
+    std::uint32_t nsym;
+    std::uint32_t nstr;
+    std::uint32_t nlist;
+    std::uint32_t nstmt;
+    std::uint32_t ncell;
+    std::uint32_t ntext;
+};
+
+struct Range {
+    std::uint32_t first;
+    std::uint32_t len;
+};
+
+struct Stmt {
+    lam_u64 cell;
+    std::uint32_t lists_end;
+    std::uint32_t pad;
+};
+
+static_assert(std::endian::native == std::endian::little, "the .llc format is little endian");
+
+struct Writer {
+    std::vector<Range> syms;
+    std::vector<Range> strs;
+    std::vector<Range> lists;
+    std::vector<Stmt> stmts;
+    std::vector<lam_u64> cells;
+    std::vector<char> text;
+    std::unordered_map<lam_obj*, lam_u64> seen;  // symbols and strings already written
+
+    Range add_text(const char* s, size_t n) {
+        Range r{std::uint32_t(text.size()), std::uint32_t(n)};
+        text.insert(text.end(), s, s + n);
+        return r;
+    }
+
+    lam_u64 add(lam_value v) {
+        switch (v.type()) {
+            case lam_type::Int:
+            case lam_type::Double:
+            case lam_type::Null:
+                return v.uval;
+            case lam_type::Symbol: {
+                auto& cell = seen[v.as_symbol()];
+                if (cell == 0) {
+                    cell = encode(KindSymbol, std::uint32_t(syms.size()));
+                    syms.push_back(add_text(v.as_symbol()->val(), v.as_symbol()->len));
+                }
+                return cell;
+            }
+            case lam_type::String: {
+                auto& cell = seen[v.as_string()];
+                if (cell == 0) {
+                    cell = encode(KindString, std::uint32_t(strs.size()));
+                    strs.push_back(add_text(v.as_string()->val(), v.as_string()->len));
+                }
+                return cell;
+            }
+            case lam_type::List: {
+                lam_list* list = v.as_list();
+                std::vector<lam_u64> items(list->len);
+                for (size_t i = 0; i < list->len; ++i) {
+                    items[i] = add(list->at(i));
+                }
+                Range r{std::uint32_t(cells.size()), std::uint32_t(items.size())};
+                cells.insert(cells.end(), items.begin(), items.end());
+                lists.push_back(r);
+                return encode(KindList, std::uint32_t(lists.size() - 1));
+            }
+            default:  // lam_parse does not produce other types
+                assert(false);
+                return lam_make_null().uval;
+        }
+    }
+
+    template <typename T>
+    static void append(std::vector<char>& out, const std::vector<T>& v) {
+        auto p = reinterpret_cast<const char*>(v.data());
+        out.insert(out.end(), p, p + v.size() * sizeof(T));
+    }
+};
+
+// A section of a .llc, read in place. The data may not be aligned.
+template <typename T>
+struct Section {
+    const char* data{};
+    size_t size{};
+
+    T operator[](size_t i) const {
+        T t;
+        memcpy(&t, data + i * sizeof(T), sizeof(T));
+        return t;
+    }
+};
+
+struct Reader {
+    const char* cur;
+    const char* end;
+
+    template <typename T>
+    bool take(Section<T>& out, size_t n) {
+        if (size_t(end - cur) / sizeof(T) < n) {
+            return false;
+        }
+        out = {cur, n};
+        cur += n * sizeof(T);
+        return true;
+    }
+};
+
+}  // namespace
+
+lam_u64 lam_llc_hash(const char* src, size_t len) {
+    lam_u64 h = 0xcbf29ce484222325;  // FNV-1a, the same for every build
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ static_cast<unsigned char>(src[i])) * 0x100000001b3;
+    }
+    return h;
+}
+
+lam_result lam_llc_save(lam_vm* vm, const char* src, size_t len, std::vector<char>& out) {
+    Writer w;
+    const char* end = src + len;
+    for (const char* cur = src; cur < end;) {
+        const char* next = nullptr;
+        lam_result res = lam_parse(vm, cur, end, &next);
+        if (res.code != 0) {
+            return res;
+        }
+        cur = next;
+        lam_u64 cell = w.add(res.value);
+        w.stmts.push_back({cell, std::uint32_t(w.lists.size()), 0});
+    }
+
+    Header h{};
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.source_hash = lam_llc_hash(src, len);
+    h.nsym = std::uint32_t(w.syms.size());
+    h.nstr = std::uint32_t(w.strs.size());
+    h.nlist = std::uint32_t(w.lists.size());
+    h.nstmt = std::uint32_t(w.stmts.size());
+    h.ncell = std::uint32_t(w.cells.size());
+    h.ntext = std::uint32_t(w.text.size());
+    out.clear();
+    auto p = reinterpret_cast<const char*>(&h);
+    out.insert(out.end(), p, p + sizeof(h));
+    Writer::append(out, w.syms);
+    Writer::append(out, w.strs);
+    Writer::append(out, w.lists);
+    Writer::append(out, w.stmts);
+    Writer::append(out, w.cells);
+    out.insert(out.end(), w.text.begin(), w.text.end());
+    return lam_result::ok(lam_make_null());
+}
+
+bool lam_llc_source_hash(const void* data, size_t len, lam_u64* hash) {
+    Header h;
+    if (len < sizeof(h)) {
+        return false;
+    }
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, Magic, sizeof(Magic)) != 0 || h.version != Version) {
+        return false;
+    }
+    *hash = h.source_hash;
+    return true;
+}
+
+lam_result lam_llc_eval(lam_vm* vm, const void* data, size_t len) {
+    const lam_result invalid = lam_result::fail(LlcInvalid, "Not a valid .llc");
+    Header h;
+    if (lam_u64 hash; !lam_llc_source_hash(data, len, &hash)) {
+        return invalid;
+    }
+    memcpy(&h, data, sizeof(h));
+    Reader in{static_cast<const char*>(data) + sizeof(h), static_cast<const char*>(data) + len};
+    Section<Range> syms, strs, lists;
+    Section<Stmt> stmts;
+    Section<lam_u64> cells;
+    Section<char> text;
+    if (!in.take(syms, h.nsym) || !in.take(strs, h.nstr) || !in.take(lists, h.nlist) ||
+        !in.take(stmts, h.nstmt) || !in.take(cells, h.ncell) || !in.take(text, h.ntext)) {
+        return invalid;
+    }
+    auto fits = [](Range r, size_t size) { return r.first <= size && r.len <= size - r.first; };
+    for (const auto* section : {&syms, &strs}) {
+        for (size_t i = 0; i < section->size; ++i) {
+            if (!fits((*section)[i], text.size)) {
+                return invalid;
+            }
+        }
+    }
+    for (size_t i = 0; i < lists.size; ++i) {
+        if (!fits(lists[i], cells.size)) {
+            return invalid;
+        }
+    }
+
+    // Symbols and strings are kept on the stack until all statements have been evaluated.
+    size_t env_slot = vm->stack.size() - 1;
+    std::vector<lam_value> objs;
+    for (size_t i = 0; i < syms.size; ++i) {
+        objs.push_back(lam_make_symbol(vm, text.data + syms[i].first, syms[i].len));
+    }
+    for (size_t i = 0; i < strs.size; ++i) {
+        objs.push_back(lam_make_string(vm, text.data + strs[i].first, strs[i].len));
+    }
+    vm->stack.push_back(lam_make_list_v(vm, objs.data(), objs.size()));
+    size_t objs_slot = vm->stack.size() - 1;
+
+    std::vector<lam_value> built;  // lists of the current statement
+    std::uint32_t lists_begin = 0;
+    // Decode a cell of the current statement which may refer to the lists built before 'limit'.
+    auto decode = [&](lam_u64 cell, std::uint32_t limit, lam_value* out) {
+        if ((cell & lam_Magic::Mask) != lam_Magic::TagObj) {
+            *out = {.uval = cell};
+            return true;
+        }
+        lam_list* table = vm->stack[objs_slot].as_list();
+        auto index = std::uint32_t(cell);
+        switch ((cell & ~lam_Magic::Mask) >> 32) {
+            case KindSymbol:
+                if (index >= h.nsym) {
+                    return false;
+                }
+                *out = table->at(index);
+                return true;
+            case KindString:
+                if (index >= h.nstr) {
+                    return false;
+                }
+                *out = table->at(h.nsym + index);
+                return true;
+            case KindList:
+                if (index < lists_begin || index >= limit) {
+                    return false;
+                }
+                *out = built[index - lists_begin];
+                return true;
+            default:
+                return false;
+        }
+    };
+    // Rebuild the statement, there are no safe points until it is evaluated.
+    auto build = [&](const Stmt& stmt, lam_value* out) {
+        if (stmt.lists_end < lists_begin || stmt.lists_end > h.nlist) {
+            return false;
+        }
+        built.clear();
+        std::vector<lam_value> items;
+        for (std::uint32_t i = lists_begin; i < stmt.lists_end; ++i) {
+            Range r = lists[i];
+            items.resize(r.len);
+            for (std::uint32_t j = 0; j < r.len; ++j) {
+                if (!decode(cells[r.first + j], i, &items[j])) {
+                    return false;
+                }
+            }
+            built.push_back(lam_make_list_v(vm, items.data(), items.size()));
+        }
+        return decode(stmt.cell, stmt.lists_end, out);
+    };
+
+    lam_result res = lam_result::ok(lam_make_null());
+    for (size_t i = 0; i < stmts.size; ++i) {
+        Stmt stmt = stmts[i];
+        lam_value val;
+        if (!build(stmt, &val)) {
+            res = invalid;
+            break;
+        }
+        lists_begin = stmt.lists_end;
+        lam_eval(val, vm->stack[env_slot].as_env());
+    }
+    vm->stack.resize(objs_slot);
+    return res;
+}
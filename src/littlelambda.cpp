@@ -1,30 +1,178 @@
 #include "littlelambda.h"
 #include "lam_core.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
 struct lila_vm : public lam_vm {};
 
+struct lila_parser : public lam_parser {
+    lila_vm* vm;
+};
+
 lila_hooks::~lila_hooks() {}
 
+// Modules smaller than this are imported on the calling thread only.
+static constexpr size_t ParallelImportBytes = 64 * 1024;
+
+// Hooks of the vms which parse on other threads, as the host's need not be thread safe.
+struct ParseHooks : lila_hooks {
+    void* mem_alloc(size_t size) override { return malloc(size); }
+    void mem_free(void* addr) override { free(addr); }
+    void init() override {}
+    void quit() override {}
+    void output(const char*, size_t) override {}
+    lila_result import(lila_vm*, const char*) override { return lila_result::FileNotFound; }
+};
+
+// Split module source into slices of whole statements of about 'size' bytes.
+static std::vector<const char*> split_statements(const char* cur, const char* end, size_t size) {
+    std::vector<const char*> cuts{cur};
+    lam_parser p;
+    while (cur < end) {
+        const char* start = nullptr;
+        // Errors and a top level "(... .)" leave the rest to the last slice.
+        if (lam_parser_scan(&p, cur, end, &start, &cur).code != 0) {
+            break;
+        }
+        p = {};
+        if (size_t(cur - cuts.back()) >= size) {
+            cuts.push_back(cur);
+        }
+    }
+    if (cuts.back() != end) {
+        cuts.push_back(end);
+    }
+    return cuts;
+}
+
+// Parse slices of the module into .llc on several threads, each with a vm of its own, then
+// evaluate them in order. Symbols are interned into 'vm' as each slice is loaded.
+static lila_result import_parallel(lila_vm* vm, const char* name, const char* src, size_t len) {
+    unsigned nthreads = vm->parse_threads;
+    // More slices than threads, to even out the work.
+    std::vector<const char*> cuts = split_statements(src, src + len, len / (4 * nthreads) + 1);
+    size_t nslices = cuts.size() - 1;
+    std::vector<std::vector<char>> llcs(nslices);  // empty if the slice does not parse
+    std::atomic<size_t> next_slice{0};
+    auto parse = [&]() {
+        ParseHooks hooks;
+        lila_vm* worker = lila_vm_new(&hooks);
+        for (size_t i; (i = next_slice++) < nslices;) {
+            if (lam_llc_save(worker, cuts[i], cuts[i + 1] - cuts[i], llcs[i]).code != 0) {
+                llcs[i].clear();
+            }
+            if (lam_at_safe_point(worker)) {
+                lam_gc_safe_point(worker);
+            }
+        }
+        lila_vm_delete(worker);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::min<size_t>(nthreads, nslices); ++i) {
+        threads.emplace_back(parse);
+    }
+    parse();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    vm->stack.push_back(lam_make_env(vm, vm->root, name));
+    for (const std::vector<char>& llc : llcs) {
+        if (llc.empty() || lam_llc_eval(vm, llc.data(), llc.size()).code != 0) {
+            vm->stack.pop_back();
+            return lila_result::Fail;
+        }
+    }
+    vm->root->bind(name, vm->stack.back());
+    return lila_result::Ok;
+}
+
+// Records where the lists parsed while it is in scope come from, if enabled.
+struct LocationScope {
+    lam_vm* vm;
+    lam_parse_cursor saved;  // of the module which is importing this one
+
+    LocationScope(lam_vm* vm, const char* name, const char* src, size_t len)
+        : vm{vm}, saved{vm->locations.cursor} {
+        lam_locations& locs = vm->locations;
+        locs.cursor = {};
+        if (locs.enabled) {
+            locs.files.push_back(name);
+            locs.cursor = {src, src + len, 1, std::uint32_t(locs.files.size() - 1)};
+        }
+    }
+    ~LocationScope() { vm->locations.cursor = saved; }
+};
+
 lila_result lila_vm_import(lila_vm* vm, const char* name, const void* data, size_t len) {
+    // Owned source is parsed in place, so that strings can refer to it, and a .llc has no lines.
+    auto src = static_cast<const char*>(data);
+    if (vm->parse_threads > 1 && len >= ParallelImportBytes &&
+        !lam_owns_source(vm, src, src + len) && !vm->locations.enabled) {
+        return import_parallel(vm, name, src, len);
+    }
+    LocationScope scope{vm, name, src, len};
     const char* next = nullptr;
     auto cur = static_cast<const char*>(data);
     auto end = static_cast<const char*>(data) + len;
-    lam_env* env = lam_new_env(vm, vm->root, name);
+    // The module is kept on the stack, so it stays up to date if evaluation moves it.
+    vm->stack.push_back(lam_make_env(vm, vm->root, name));
 
     while (cur < end) {
         lam_result res = lam_parse(vm, cur, end, &next);
         if (res.code != 0) {
+            vm->stack.pop_back();
             return lila_result::Fail;
         }
-        lam_value v = lam_eval(res.value, env);
+        lam_value v = lam_eval(res.value, vm->stack.back().as_env());
         cur = next;
     }
-    lam_value mod = lam_make_value(env);
-    vm->root->bind(name, mod);
-    vm->stack.push_back(mod);
+    vm->root->bind(name, vm->stack.back());
     return lila_result::Ok;
 }
 
+size_t lila_vm_save_llc(lila_vm* vm, const void* src, size_t len, void* out, size_t cap) {
+    std::vector<char> llc;
+    lam_result res = lam_llc_save(vm, static_cast<const char*>(src), len, llc);
+    if (res.code != 0) {
+        return 0;
+    }
+    if (cap != 0) {
+        memcpy(out, llc.data(), std::min(cap, llc.size()));
+    }
+    return llc.size();
+}
+
+lila_result lila_vm_import_llc(lila_vm* vm, const char* name, const void* data, size_t len) {
+    vm->stack.push_back(lam_make_env(vm, vm->root, name));
+    lam_result res = lam_llc_eval(vm, data, len);
+    if (res.code != 0) {
+        vm->stack.pop_back();
+        return lila_result::Fail;
+    }
+    vm->root->bind(name, vm->stack.back());
+    return lila_result::Ok;
+}
+
+unsigned long long lila_llc_hash(const void* src, size_t len) {
+    return lam_llc_hash(static_cast<const char*>(src), len);
+}
+
+unsigned long long lila_llc_source_hash(const void* data, size_t len) {
+    lam_u64 hash = 0;
+    lam_llc_source_hash(data, len, &hash);
+    return hash;
+}
+
+lila_result lila_vm_import_owned(lila_vm* vm, const char* name, const void* data, size_t len) {
+    vm->sources.push_back({static_cast<const char*>(data), len});
+    return lila_vm_import(vm, name, data, len);
+}
+
 lila_vm* lila_vm_new(lila_hooks* hooks) {
     hooks->init();
     void* addr = hooks->mem_alloc(sizeof(lila_vm));
@@ -32,10 +180,15 @@ lila_vm* lila_vm_new(lila_hooks* hooks) {
     ugc_init(&vm->gc, &lam_ugc_visit, &lam_ugc_free);
     vm->gc.userdata = vm;
     vm->hooks = reinterpret_cast<lam_hooks*>(hooks);
+    lam_gc_init(vm);
     vm->root = lam_make_env_builtin(vm);
     return vm;
 }
 
+void lila_vm_set_compile(lila_vm* vm, bool enable) {
+    vm->compile = enable;
+}
+
 template <typename T>
 static inline void swap_reset_container(T& t) {
     T e;
@@ -43,6 +196,9 @@ static inline void swap_reset_container(T& t) {
 }
 
 lila_result lila_parse(lila_vm* vm, const char* input, const char* end, const char** restart) {
+    if (lam_at_safe_point(vm)) {  // a host which only parses must not grow the heap forever
+        lam_gc_safe_point(vm);
+    }
     lam_result res = lam_parse(vm, input, end, restart);
     if (res.code != 0) {
         return lila_result::Fail;
@@ -51,6 +207,49 @@ lila_result lila_parse(lila_vm* vm, const char* input, const char* end, const ch
     return lila_result::Ok;
 }
 
+lila_parser* lila_parser_new(lila_vm* vm) {
+    void* addr = vm->hooks->mem_alloc(sizeof(lila_parser));
+    auto parser = new (addr) lila_parser;
+    parser->vm = vm;
+    return parser;
+}
+
+void lila_parser_delete(lila_parser* parser) {
+    lam_hooks* hooks = parser->vm->hooks;
+    parser->~lila_parser();
+    hooks->mem_free(parser);
+}
+
+static lila_result push_parsed(lila_vm* vm, const lam_result& res) {
+    if (res.code == ParseEndOfInput) {
+        return lila_result::EndOfInput;
+    }
+    if (res.code != 0) {
+        return lila_result::Fail;
+    }
+    vm->stack.push_back(res.value);
+    return lila_result::Ok;
+}
+
+lila_result lila_parser_feed(lila_parser* parser,
+                             const char* input,
+                             const char* end,
+                             const char** restart) {
+    lila_vm* vm = parser->vm;
+    if (lam_at_safe_point(vm)) {  // the parser holds no values
+        lam_gc_safe_point(vm);
+    }
+    return push_parsed(vm, lam_parser_feed(vm, parser, input, end, restart));
+}
+
+lila_result lila_parser_finish(lila_parser* parser) {
+    lila_vm* vm = parser->vm;
+    if (lam_at_safe_point(vm)) {
+        lam_gc_safe_point(vm);
+    }
+    return push_parsed(vm, lam_parser_finish(vm, parser));
+}
+
 lila_result lila_eval(lila_vm* vm, int index) {
     lam_value val = lam_eval(vm, vm->stack[index]);
     vm->stack[index] = val;
@@ -99,13 +298,13 @@ lila_result lila_setmap(lila_vm* vm, int index) {
         return lila_result::Fail;
     }
     auto env = m.as_env();
-    lam_value val = env->lookup(k.as_symbol()->val());
+    lam_value val = env->lookup(k.as_symbol());
     if (val.type() == lam_type::Error) {
         vm->stack.pop_back();
         vm->stack.back() = lam_make_error(vm, 0, "Key already exists");
         return lila_result::Fail;
     }
-    env->bind_upsert(k.as_symbol()->val(), vm->stack.back());
+    env->bind_upsert(k.as_symbol(), vm->stack.back());
     vm->stack.pop(2);
 
     return lila_result::Ok;
@@ -123,7 +322,7 @@ lila_result lila_getmap(lila_vm* vm, int index) {
         return lila_result::Fail;
     }
     auto env = m.as_env();
-    lam_value val = env->lookup(k.as_symbol()->val());
+    lam_value val = env->lookup(k.as_symbol());
     vm->stack.back() = val;
     return lila_result::Ok;
 }
@@ -135,8 +334,14 @@ lila_result lila_call(lila_vm* vm, int narg, int nres) {
     if (func == nullptr) {
         return lila_result::Fail;
     }
+    // The call may push onto vm->stack and move it, so the arguments go in an operand window.
+    lam_value* args = vm->operands.enter(narg);
+    for (int i = 0; i < narg; ++i) {
+        args[i] = vm->stack[i - narg];
+    }
     while (1) {
-        lam_value_or_tail_call ret = func->invoke(func, vm->root, &vm->stack[-narg], narg);
+        lam_value_or_tail_call ret = lam_apply(func, vm->root, args, narg);
+        vm->operands.leave(args);
         if (ret.env == nullptr) {
             vm->stack.pop(narg + 1);
             vm->stack.push_back(ret.value);
@@ -164,9 +369,15 @@ lila_value lila_peekstack(lila_vm* vm, int index) {
         case lam_type::BigInt:
             return {.type = lila_type::BigInt};
         case lam_type::String:
-            return {.type = lila_type::String, .string = val.as_string()->val()};
+            return {.type = lila_type::String,
+                    .string = val.as_string()->val(),
+                    .len = val.as_string()->len};
         case lam_type::Symbol:
-            return {.type = lila_type::Symbol, .symbol = val.as_symbol()->val()};
+            return {.type = lila_type::Symbol,
+                    .symbol = val.as_symbol()->val(),
+                    .len = val.as_symbol()->len};
+        case lam_type::Error:
+            return {.type = lila_type::Error};
 
         default:
             assert(false);
@@ -186,6 +397,34 @@ int lila_tointeger(lila_vm* vm, int index) {
     return v.as_int();
 }
 
+void lila_vm_gc_stats(lila_vm* vm, lila_gc_stats* stats) {
+    stats->allocs = vm->gc_stats.alloc_count;
+    stats->frees = vm->gc_stats.free_count;
+    stats->minor_collections = vm->gc_stats.minor_count;
+    stats->major_collections = vm->gc_stats.major_count;
+    stats->promoted = vm->gc_stats.promoted_count;
+    stats->max_pause_us = vm->gc_stats.pause_max_ns / 1000;
+    static_assert(sizeof(stats->pauses) == sizeof(vm->gc_stats.pause_hist));
+    memcpy(stats->pauses, vm->gc_stats.pause_hist, sizeof(stats->pauses));
+}
+
+void lila_vm_set_gc_pause(lila_vm* vm, unsigned microseconds) {
+    vm->gc_pace.budget_ns = lam_u64(microseconds) * 1000;
+}
+
+void lila_vm_set_source_locations(lila_vm* vm, bool enable) {
+    vm->locations.enabled = enable;
+}
+
+bool lila_source_location(lila_vm* vm, int index, const char** file, unsigned* line) {
+    lam_obj* obj = vm->stack[index].obj_cast_value();
+    return obj && lam_find_location(vm, obj, file, line);
+}
+
+void lila_vm_set_parse_threads(lila_vm* vm, unsigned threads) {
+    vm->parse_threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
 bool lila_isnull(lila_vm* vm, int index) {
     const lam_value& v = vm->stack[index];
     return v.type() == lam_type::Null;
@@ -194,12 +433,18 @@ bool lila_isnull(lila_vm* vm, int index) {
 void lila_vm_delete(lila_vm* vm) {
     vm->stack.resize(0);
     // Test: remove garbage
-    ugc_collect(&vm->gc);
+    lam_collect_major(vm);
     // Test: everything else
     vm->root = nullptr;
+    vm->forms = {};
     swap_reset_container(vm->imports);
-    ugc_collect(&vm->gc);
+    lam_collect_major(vm);
+    lam_gc_quit(vm);
+    for (lam_source& src : vm->sources) {  // no strings refer to them anymore
+        vm->hooks->source_free(src.data, src.len);
+    }
     auto hooks = vm->hooks;
+    vm->~lila_vm();
     hooks->mem_free(vm);
     hooks->quit();
 }
@@ -11,6 +11,7 @@ enum class lila_result : int {
     Ok = 0,
     Fail = -1,
     FileNotFound = -2,
+    EndOfInput = -3,
 };
 
 struct lila_hooks {
@@ -21,14 +22,70 @@ struct lila_hooks {
     virtual void quit() = 0;
     virtual void output(const char* s, size_t n) = 0;
     virtual lila_result import(lila_vm* vm, const char* modname) = 0;
+    /// Release module source passed to lila_vm_import_owned.
+    virtual void source_free(const void* /*data*/, size_t /*len*/) {}
 };
 
 /// Initialize a new vm.
 lila_vm* lila_vm_new(lila_hooks* hooks);
 
+/// Enable or disable compiling $define/$lambda bodies to bytecode (enabled by default).
+/// Only affects functions defined after the call.
+void lila_vm_set_compile(lila_vm* vm, bool enable);
+
+/// Garbage collector counters, since the vm was created.
+struct lila_gc_stats {
+    unsigned long long allocs;             // objects allocated
+    unsigned long long frees;              // old objects freed by major collections
+    unsigned long long minor_collections;  // nursery collections
+    unsigned long long major_collections;  // full collections
+    unsigned long long promoted;           // objects which survived a minor collection
+    unsigned long long max_pause_us;       // longest pause at a safe point
+    // Pauses at safe points by duration: pauses[0] counts the ones under 1us, pauses[i] the ones
+    // from 2^(i-1)us up to 2^i us, and the last bucket all the longer ones.
+    unsigned long long pauses[16];
+};
+
+/// Read the garbage collector counters.
+void lila_vm_gc_stats(lila_vm* vm, lila_gc_stats* stats);
+
+/// Set how long the garbage collector may pause the program at once, in microseconds (500 by
+/// default). Full collections are done incrementally in steps which stop once this is used up.
+/// A pause may still run over the budget: a minor collection always runs to completion, and
+/// each pause does enough steps to keep up with the allocation rate.
+void lila_vm_set_gc_pause(lila_vm* vm, unsigned microseconds);
+
+/// Parse large modules on up to 'threads' threads (1 by default), or one per core if 0.
+/// Statements are still evaluated in order, on the thread which imports the module.
+void lila_vm_set_parse_threads(lila_vm* vm, unsigned threads);
+
+/// Record the module and line which each list is parsed from by lila_vm_import (off by default).
+/// Modules are then imported on one thread.
+void lila_vm_set_source_locations(lila_vm* vm, bool enable);
+
 /// Import a module with the given name and contents (sans-io).
 lila_result lila_vm_import(lila_vm* vm, const char* name, const void* data, size_t len);
 
+/// Like lila_vm_import, but the vm keeps 'data' until it is deleted and then passes it to
+/// hooks->source_free, even if the import fails. 'data' is only read, so it may be a read only
+/// memory mapped file. String literals without escapes refer to it rather than being copied.
+lila_result lila_vm_import_owned(lila_vm* vm, const char* name, const void* data, size_t len);
+
+/// Parse module source into the precompiled .llc format, which can be imported without parsing.
+/// Writes up to 'cap' bytes to 'out' and returns the size of the .llc, so a call with 'cap' 0
+/// gives the size of the buffer needed. Returns 0 if the source does not parse. (sans-io)
+size_t lila_vm_save_llc(lila_vm* vm, const void* src, size_t len, void* out, size_t cap);
+
+/// Import a module from a .llc made by lila_vm_save_llc. 'data' is only read, so it may be a
+/// read only memory mapped file.
+lila_result lila_vm_import_llc(lila_vm* vm, const char* name, const void* data, size_t len);
+
+/// Hash of module source, e.g. as the key of a cache of .llc files.
+unsigned long long lila_llc_hash(const void* src, size_t len);
+
+/// The hash of the source which a .llc was made from, or 0 if 'data' is not a .llc.
+unsigned long long lila_llc_source_hash(const void* data, size_t len);
+
 /// Parse one statement from the input. On success,
 /// * the statement is placed on top of the stack
 /// * the 'restart' pointer is set past the input consumed
@@ -37,6 +94,30 @@ lila_result lila_vm_import(lila_vm* vm, const char* name, const void* data, size
 /// Call this multiple times to consume all input.
 lila_result lila_parse(lila_vm* vm, const char* input, const char* end, const char** restart);
 
+struct lila_parser;
+
+/// Create a parser for input which arrives in chunks, e.g. from a pipe or a socket.
+lila_parser* lila_parser_new(lila_vm* vm);
+
+/// Destroy a parser, before the vm it was created for.
+void lila_parser_delete(lila_parser* parser);
+
+/// Like lila_parse, but a statement may span any number of chunks of input.
+/// * Ok: the statement is on top of the stack and 'restart' is set past the input consumed.
+///   Call again with the rest of the chunk.
+/// * EndOfInput: the chunk ended first. The parser keeps what there is of the statement, which
+///   is never more than its text, so call again with the next chunk.
+/// * Fail: the input is not valid and the statement is dropped.
+/// A statement which ends with a word, or "(... .)" at the top level, only ends with the input.
+lila_result lila_parser_feed(lila_parser* parser,
+                             const char* input,
+                             const char* end,
+                             const char** restart);
+
+/// Call at the end of the input. Puts the last statement on top of the stack and returns Ok,
+/// returns EndOfInput if there is none, or Fail if the input ended inside one.
+lila_result lila_parser_finish(lila_parser* parser);
+
 /// Evaluate stack[idx] and replace it with the evaluation.
 lila_result lila_eval(lila_vm* vm, int idx);
 
@@ -77,9 +158,10 @@ struct lila_value {
         double number;
         int integer;
         unsigned long long opaque;
-        const char* string;
+        const char* string;  // not null terminated if it refers to source, see 'len'
         const char* symbol;
     };
+    size_t len;  // of string and symbol
 };
 
 /// Map assignment: stack[index][k] = v
@@ -100,6 +182,10 @@ lila_result lila_getmap(lila_vm* vm, int index);
 lila_result lila_call(lila_vm* vm, int narg, int nres);
 
 
+/// Where the list at stack[index] was parsed from, if it was recorded.
+/// 'file' is the name of the module and is valid until the vm is deleted.
+bool lila_source_location(lila_vm* vm, int index, const char** file, unsigned* line);
+
 /// Peek at the value at stack[index].
 /// The value is only valid until the next mutation.
 lila_value lila_peekstack(lila_vm* vm, int index);
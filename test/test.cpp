@@ -1,5 +1,7 @@
 #define _CRT_SECURE_NO_WARNINGS
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <format>
 #include <string>
 #include <unordered_map>
@@ -121,6 +123,7 @@ struct DebugHooks : lila_hooks {
     lila_result import(lila_vm* vm, const char* modname) override {
         return import_impl(vm, modname);
     }
+    void source_free(const void* data, size_t len) override { mem_free(const_cast<void*>(data)); }
 
     std::unordered_map<void*, std::stacktrace> _allocs;
 };
@@ -141,6 +144,7 @@ struct SimpleHooks : lila_hooks {
         return import_impl(vm, modname);
     }
     void output(const char* s, size_t n) { fwrite(s, 1, n, stdout); }
+    void source_free(const void* data, size_t len) override { mem_free(const_cast<void*>(data)); }
 };
 
 void test_all(lila_hooks& hooks) {
@@ -255,6 +259,376 @@ void test_all(lila_hooks& hooks) {
         lila_vm_delete(vm);
     }
 
+    // Strings without escapes refer to owned source
+    if (1) {
+        static const char src[] = R"---(
+            ($define greeting "hello")
+            ($define escaped "two\nlines")
+        )---";
+        lila_vm* vm = lila_vm_new(&hooks);
+        auto data = static_cast<char*>(hooks.mem_alloc(sizeof(src) - 1));
+        memcpy(data, src, sizeof(src) - 1);
+        test_true(lila_vm_import_owned(vm, "cfg", data, sizeof(src) - 1) == lila_result::Ok);
+        lila_parse_or_die(vm, "cfg.greeting");
+        lila_eval(vm, -1);
+        lila_value v = lila_peekstack(vm, -1);
+        test_true(v.type == lila_type::String && v.len == 5);
+        test_true(v.string > data && v.string < data + sizeof(src) - 1);
+        lila_parse_or_die(vm, "cfg.escaped");
+        lila_eval(vm, -1);
+        v = lila_peekstack(vm, -1);
+        test_true(v.len == 9 && strcmp(v.string, "two\nlines") == 0);
+        lila_vm_delete(vm);  // releases 'data'
+    }
+
+    // Precompiled modules
+    if (1) {
+        static const char src[] = R"---(
+            ;; geometry
+            ($define pi 3.14159)
+            ($define greeting "hello\nworld")
+            ($define (area r) (* pi (* r r)))
+            ($module shapes .)
+            ($define (square x) (* x x))
+            ($define name 'square)
+        )---";
+        lila_vm* vm = lila_vm_new(&hooks);
+        size_t len = lila_vm_save_llc(vm, src, sizeof(src) - 1, nullptr, 0);
+        test_true(len > 0);
+        std::vector<char> llc(len);
+        test_true(lila_vm_save_llc(vm, src, sizeof(src) - 1, llc.data(), len) == len);
+        test_true(lila_llc_source_hash(llc.data(), len) == lila_llc_hash(src, sizeof(src) - 1));
+        test_true(lila_llc_source_hash(src, sizeof(src) - 1) == 0);
+        lila_vm_delete(vm);
+
+        vm = lila_vm_new(&hooks);
+        test_true(lila_vm_import_llc(vm, "geo", llc.data(), len - 1) == lila_result::Fail);
+        test_true(lila_vm_import_llc(vm, "geo", src, sizeof(src) - 1) == lila_result::Fail);
+        test_true(lila_vm_import_llc(vm, "geo", llc.data(), len) == lila_result::Ok);
+        lila_parse_or_die(vm, "(+ (geo.area 1) (geo.shapes.square 3))");
+        lila_eval(vm, -1);
+        test_true(lila_tonumber(vm, -1) > 12.14);
+        test_true(lila_tonumber(vm, -1) < 12.15);
+        lila_vm_delete(vm);
+    }
+
+    // Cached lookups see later definitions
+    if (1) {
+        static const char src[] = R"---(
+            ($define y 1)
+            ($module m ($define (h) y) ($define r1 (h)) ($define y 5) ($define r2 (h)))
+            ($define (g) (+ 10 2))
+            ($define r1 (g))
+            ($define + -)
+            ($define r2 (g))
+        )---";
+        lila_vm* vm = lila_vm_new(&hooks);
+        test_true(lila_vm_import(vm, "shadow", src, sizeof(src) - 1) == lila_result::Ok);
+        lila_parse_or_die(vm, "(+ (- shadow.r1 shadow.r2) (* 10 (- shadow.m.r2 shadow.m.r1)))");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 4 + 40);
+        lila_vm_delete(vm);
+    }
+
+    // Paths and forms which start with a parameter see the argument of each call
+    if (1) {
+        static const char src[] = R"---(
+            ($module a ($define x 1))
+            ($module b ($define x 2))
+            ($define (get m) m.x)
+            ($define (app begin) (begin 1 2))
+            ($define r (+ (* 100 (+ (get a) (get b))) (+ (* 10 (app +)) (app -))))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "paths", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "paths.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 300 + 30 - 1);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // Calls with each fixed number of arguments, and with a rest list
+    if (1) {
+        static const char src[] = R"---(
+            ($define (f0) 1)
+            ($define (f4 a b c d) (- (* a b) (+ c d)))
+            ($define (f5 a b c d e) (+ (f4 a b c d) e))
+            ($define (rest a . more) (+ a (mapreduce ($lambda (x) x) + more)))
+            ($define ($o3 a b c) env (eval b env))
+            ($define r (+ (+ (f0) (f4 3 4 1 2))
+                          (+ (f5 3 4 1 2 10) (+ (rest 100 200 300) ($o3 x 1000 z)))))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "arity", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "arity.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 1 + 9 + 19 + 600 + 1000);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // Closures capture the parameters of enclosing calls
+    if (1) {
+        static const char src[] = R"---(
+            ($define (adder n) ($lambda (x) (+ x n)))
+            ($define (curry a) ($lambda (b) ($lambda (c) (- (* a b) c))))
+            ($define (peek n) ($lambda () (eval 'n (getenv))))
+            ($define (shadow a) ($lambda () (begin ($define a 10) a)))
+            ($define ($peek) env (eval 'n env))
+            ($define (f n) ($lambda () ($peek)))
+            ($define r (+ (+ ((adder 5) 1) (((curry 2) 3) 1)) (+ ((peek 7)) ((shadow 1)))))
+            ($define r2 ((f 5)))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "closures", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "closures.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 6 + 5 + 7 + 10);
+            lila_parse_or_die(vm, "closures.r2");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 5);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // Self tail calls reuse their frame unless it escaped
+    if (1) {
+        static const char src[] = R"---(
+            ($define (count n acc) ($if (<= n 0) acc (count (- n 1) (+ acc 2))))
+            ($define (envs n e) ($if (<= n 0) (eval 'n e) (envs (- n 1) (getenv))))
+            ($define r (+ (count 200000 0) (envs 3 (getenv))))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "loop", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "loop.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 400000 + 1);
+            lila_gc_stats stats;
+            lila_vm_gc_stats(vm, &stats);
+            test_true(stats.minor_collections == 0);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // $loop updates its bindings together, and in place unless a closure kept them
+    if (1) {
+        static const char src[] = R"---(
+            ($define (sum n) ($loop (i 0 acc 0) (<= (+ i 1) n) ((+ i 1) (+ acc i)) acc))
+            ($define swap ($loop (a 1 b 2 k 0) (<= k 0) (b a (+ k 1)) (- a b)))
+            ($define last ($loop (i 0 f ($lambda () -1)) (<= i 2) ((+ i 1) ($lambda () i)) (f)))
+            ($define r (+ (+ (sum 10) swap) last))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "loops", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "loops.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 45 + 1 + 2);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // Arithmetic on ints and doubles is inline, bigints, mixed types and other callables are not
+    if (1) {
+        static const char src[] = R"---(
+            ($define (calc a b) (+ (- a b) (* a b)))
+            ($define (ratio x y) (/ (+ x y) (- x y)))
+            ($define (shadowed + a) (+ a 3))
+            ($define r (+ (+ (+ (calc 7 2) (ratio 3.0 1.0)) (calc 1.5 2))
+                          (+ (shadowed - 5) (<= (bigint 1) 2))))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "arith", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "arith.r");
+            lila_eval(vm, -1);
+            test_true(lila_tonumber(vm, -1) == 19 + 2.0 + 2.5 + 2 + 1);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // The numeric tower: ints overflow into bigints, anything with a double is a double
+    if (1) {
+        static const char src[] = R"---(
+            ($define checks (list
+                (= (* 65536 65536) (* (bigint 65536) 65536))
+                (> (+ 2147483647 1) 2147483647)
+                (= (- (- 0 2147483647) 2) (- (bigint -2147483647) 2))
+                (= (mod -7 3) 2) (= (mod 7 -3) -2) (= (mod 7.5 2) 1.5) (= (mod (bigint -7) 3) 2)
+                (= (/ 7 2) 3.5) (= (/ (bigint 7) 2) 3.5) (= 2 2.0) (<= 2 2)
+                (< 1 2) (> 2.5 1) (>= (bigint 3) 3) (< (bigint 1) 1.5) (> 2.5 (bigint 2))
+                (= (- 10 (bigint 3)) 7) (= (+ -5 (bigint 3)) -2) (< 2 (bigint 3))))
+            ($define passed (mapreduce ($lambda (x) x) + checks))
+            ($define (remainder x y) (mod x y))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            test_true(lila_vm_import(vm, "tower", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "tower.passed");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 19);
+            lila_parse_or_die(vm, "(- 2 5)");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == -3);
+            lila_parse_or_die(vm, "(mod 1 0)");
+            lila_eval(vm, -1);
+            test_true(lila_peekstack(vm, -1).type == lila_type::Error);
+            lila_parse_or_die(vm, "(mod 1.0 0.0)");
+            lila_eval(vm, -1);
+            test_true(lila_peekstack(vm, -1).type == lila_type::Error);
+            lila_parse_or_die(vm, "(mapreduce ($lambda (x) x) mod (list 1.0 0))");
+            lila_eval(vm, -1);
+            test_true(lila_peekstack(vm, -1).type == lila_type::Error);
+            lila_parse_or_die(vm, "(tower.remainder 1.0 0.0)");
+            lila_eval(vm, -1);
+            test_true(lila_peekstack(vm, -1).type == lila_type::Error);
+            lila_vm_delete(vm);
+        }
+    }
+
+    // Call frames which escape through getenv or an operative outlive the call
+    if (1) {
+        static const char src[] = R"---(
+            ($define (env-of x) (getenv))
+            ($define ($env-here) env env)
+            ($define (op-env-of x) ($env-here))
+            ($define (churn n) ($if (<= n 0) 0 (+ 1 (churn (- n 1)))))
+            ($define (probe e) (begin (churn 100) (eval 'x e)))
+            ($define (via-getenv) (probe (env-of 42)))
+            ($define (via-operative) (probe (op-env-of 7)))
+            ($define r (+ (via-getenv) (via-operative)))
+        )---";
+        lila_vm* vm = lila_vm_new(&hooks);
+        test_true(lila_vm_import(vm, "escape", src, sizeof(src) - 1) == lila_result::Ok);
+        lila_parse_or_die(vm, "escape.r");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 49);
+        lila_vm_delete(vm);
+    }
+
+    // Source locations of lists
+    if (1) {
+        static const char src[] = R"---(;; line 1
+            ($define (depth n) ($if (<= n 0) 0 (+ 1 (depth (- n 1)))))
+            ($define (main) (depth 20000))
+            ($define code '(a
+                (b c)))
+            ($define later
+                '(x y))
+        )---";
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_vm_set_source_locations(vm, true);
+        test_true(lila_vm_import(vm, "where", src, sizeof(src) - 1) == lila_result::Ok);
+        lila_parse_or_die(vm, "(where.main)");  // moves the lists out of the nursery
+        lila_eval(vm, -1);
+        lila_gc_stats stats;
+        lila_vm_gc_stats(vm, &stats);
+        test_true(stats.minor_collections > 0);
+        const char* file = nullptr;
+        unsigned line = 0;
+        lila_parse_or_die(vm, "where.code");
+        lila_eval(vm, -1);
+        test_true(lila_source_location(vm, -1, &file, &line));
+        test_true(strcmp(file, "where") == 0 && line == 4);
+        lila_parse_or_die(vm, "where.later");
+        lila_eval(vm, -1);
+        test_true(lila_source_location(vm, -1, &file, &line) && line == 7);
+        lila_parse_or_die(vm, "(a b)");  // not from a module
+        test_true(!lila_source_location(vm, -1, &file, &line));
+        lila_vm_delete(vm);
+    }
+
+    // Large modules parsed on several threads
+    if (1) {
+        std::string src = ";; generated\n";
+        for (int i = 0; i < 5000; ++i) {
+            auto n = std::to_string(i);
+            src += "($define (f" + n + " x) (+ x " + n + "))\n($define s" + n + " \"s\\n\")\n";
+        }
+        src += "($module tail .)\n($define last (f4999 1))\n";
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_vm_set_parse_threads(vm, 4);
+        test_true(lila_vm_import(vm, "big", src.data(), src.size()) == lila_result::Ok);
+        lila_parse_or_die(vm, "(+ (big.f1234 1) big.tail.last)");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 1235 + 5000);
+        lila_parse_or_die(vm, "big.s4321");
+        lila_eval(vm, -1);
+        test_true(strcmp(lila_peekstack(vm, -1).string, "s\n") == 0);
+        src.insert(src.size() / 2, ")");
+        test_true(lila_vm_import(vm, "bad", src.data(), src.size()) == lila_result::Fail);
+        lila_vm_delete(vm);
+    }
+
+    // Statements split across chunks
+    if (1) {
+        static const char src[] = R"---(
+            ;; a comment (with a list in it)
+            ($define greeting "hello (world) ;; not a comment\n")
+            ($define (sq x) (* x x))
+            'quoted ;; and a comment
+            (sq 12)
+            ($define n (+ (sq 3) 4))
+            n)---";
+        for (size_t chunk = 1; chunk < 8; ++chunk) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_parser* parser = lila_parser_new(vm);
+            int statements = 0;
+            for (size_t i = 0; i < sizeof(src) - 1; i += chunk) {
+                const char* cur = src + i;
+                const char* end = src + std::min(i + chunk, sizeof(src) - 1);
+                for (const char* next = nullptr; cur < end; cur = next) {
+                    lila_result res = lila_parser_feed(parser, cur, end, &next);
+                    if (res != lila_result::Ok) {
+                        test_true(res == lila_result::EndOfInput && next == end);
+                        break;
+                    }
+                    lila_eval(vm, -1);
+                    lila_pop(vm, 1);
+                    statements += 1;
+                }
+            }
+            test_true(statements == 5);
+            test_true(lila_parser_finish(parser) == lila_result::Ok);
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 13);
+            test_true(lila_parser_finish(parser) == lila_result::EndOfInput);
+            lila_parser_delete(parser);
+            lila_vm_delete(vm);
+        }
+
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_parser* parser = lila_parser_new(vm);
+        const char* next = nullptr;
+        auto feed = [&](const char* s) {
+            return lila_parser_feed(parser, s, s + strlen(s), &next);
+        };
+        test_true(feed("(begin .) ($define a 1)") == lila_result::EndOfInput);
+        test_true(feed(" (+ a 2)") == lila_result::EndOfInput);
+        test_true(lila_parser_finish(parser) == lila_result::Ok);
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 3);
+        test_true(feed("(a b))") == lila_result::Ok);
+        test_true(feed(next) == lila_result::Fail);
+        test_true(feed("; x") == lila_result::Fail);
+        test_true(feed("(a \"b") == lila_result::EndOfInput);
+        test_true(lila_parser_finish(parser) == lila_result::Fail);
+        lila_parser_delete(parser);
+        lila_vm_delete(vm);
+    }
+
     if (0) {
         lila_vm* vm = lila_vm_new(&hooks);
         lila_parse_or_die(vm, R"---(
@@ -304,6 +678,129 @@ void test_all(lila_hooks& hooks) {
         lila_vm_delete(vm);
     }
 
+    // Symbols are interned, equal names share one symbol.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_push_symbol(vm, "interned");
+        lila_parse_or_die(vm, "interned");
+        test_true(lila_peekstack(vm, -1).symbol == lila_peekstack(vm, -2).symbol);
+        lila_vm_delete(vm);
+    }
+
+    // Compiled bodies: tail calls loop, and inlined builtins defer to a shadowing definition.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_parse_or_die(vm, R"---(
+            (begin .)
+            ($define (loop n acc) ($if (<= n 0) acc (loop (- n 1) (+ acc 2))))
+            ($define shadowed ($module m
+                ($define ($if c a b) env 42)
+                ($define (pick c) ($if c 1 2))
+                (pick 0)))
+            (+ shadowed (loop 10000 0))
+        )---");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 20042);
+        lila_vm_delete(vm);
+    }
+
+    // Parameters resolve to frame slots, unless a frame in between gained a binding by name.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_parse_or_die(vm, R"---(
+            (begin .)
+            ($define ($defx) env (eval '($define x 5) env))
+            ($define (outer x) ($lambda (y) (begin ($defx) (+ x y))))
+            ($define (plain x) ($lambda (y) (+ x y)))
+            (+ ((outer 1) 10) ((plain 100) 1000))
+        )---");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 1115);
+        lila_vm_delete(vm);
+    }
+
+    // Non tail recursion between compiled functions does not use the C stack.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_parse_or_die(vm, R"---(
+            (begin .)
+            ($define (depth n) ($if (<= n 0) 0 (+ 1 (depth (- n 1)))))
+            (depth 100000)
+        )---");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 100000);
+        lila_vm_delete(vm);
+    }
+
+    // Young objects which are still reachable survive minor collections.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_parse_or_die(vm, R"---(
+            (begin .)
+            ($define (adder x) ($lambda (y) (+ x y)))
+            ($define add1000 (adder 1000))
+            ($define (depth n) ($if (<= n 0) 0 (+ 1 (depth (- n 1)))))
+            ($define (main) (+ (depth 20000) (add1000 5)))
+            (main)
+        )---");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 21005);
+        lila_gc_stats stats;
+        lila_vm_gc_stats(vm, &stats);
+        test_true(stats.minor_collections > 0);
+        test_true(stats.promoted > 0);
+        lila_vm_delete(vm);
+    }
+
+    // Old objects which die are collected while the program runs.
+    if (1) {
+        lila_vm* vm = lila_vm_new(&hooks);
+        lila_vm_set_gc_pause(vm, 1000);
+        lila_parse_or_die(vm, R"---(
+            (begin .)
+            ($define (depth n) ($if (<= n 0) 0 (+ 1 (depth (- n 1)))))
+            ($define (repeat n) ($if (<= n 0) 0 (begin (depth 5000) (repeat (- n 1)))))
+            ($define (main) (repeat 60))
+            (main)
+        )---");
+        lila_eval(vm, -1);
+        test_true(lila_tointeger(vm, -1) == 0);
+        lila_gc_stats stats;
+        lila_vm_gc_stats(vm, &stats);
+        test_true(stats.major_collections > 0);
+        test_true(stats.frees > 0);
+        unsigned long long pauses = 0;
+        for (unsigned long long n : stats.pauses) {
+            pauses += n;
+        }
+        test_true(pauses >= stats.minor_collections);
+        lila_vm_delete(vm);
+    }
+
+    // Both generations are collected in a loop nested inside an argument
+    if (1) {
+        static const char src[] = R"---(
+            ($define (loop n acc) ($if (<= n 0) 0 (loop (- n 1) (list n n n n))))
+            ($define r (+ 1 (loop 200000 0)))
+        )---";
+        for (bool compile : {false, true}) {
+            lila_vm* vm = lila_vm_new(&hooks);
+            lila_vm_set_compile(vm, compile);
+            lila_vm_set_gc_pause(vm, 1000);
+            lila_gc_stats before;
+            lila_vm_gc_stats(vm, &before);
+            test_true(lila_vm_import(vm, "nested", src, sizeof(src) - 1) == lila_result::Ok);
+            lila_parse_or_die(vm, "nested.r");
+            lila_eval(vm, -1);
+            test_true(lila_tointeger(vm, -1) == 1);
+            lila_gc_stats after;
+            lila_vm_gc_stats(vm, &after);
+            test_true(after.minor_collections > before.minor_collections);
+            test_true(after.major_collections > before.major_collections);
+            lila_vm_delete(vm);
+        }
+    }
+
     // List comprehension
     if (0) {
         lila_vm* vm = lila_vm_new(&hooks);